@@ -35,23 +35,6 @@
 #include "WProgram.h"
 #endif
 
-// minihelper to keep Arduino backward compatibility
-static inline void wiresend(uint8_t x, TwoWire *theWire) {
-#if ARDUINO >= 100
-  theWire->write((uint8_t)x);
-#else
-  theWire->send(x);
-#endif
-}
-
-static inline uint8_t wirerecv(TwoWire *theWire) {
-#if ARDUINO >= 100
-  return theWire->read();
-#else
-  return theWire->receive();
-#endif
-}
-
 /**
  * Bit number associated to a give Pin
  */
@@ -66,62 +49,131 @@ uint8_t Adafruit_MCP23017::regForPin(uint8_t pin, uint8_t portAaddr,
 }
 
 bool Adafruit_MCP23017::ping() {
-  uint8_t result = 0;
+  uint8_t gpio[2];
+  return readRegisters(MCP23017_GPIOA, gpio, 2) == I2C_OK;
+}
 
-  _wire->beginTransmission(MCP23017_ADDRESS | i2caddr);
-  wiresend(MCP23017_GPIOA, _wire);
-  result = _wire->endTransmission();
+/**
+ * Re-reads all registers into the shadow in one sequential read. Call this
+ * if the expander may have been reset behind our back.
+ * @return true if all registers were read
+ */
+bool Adafruit_MCP23017::resync() {
+  uint8_t values[MCP23017_REGISTER_COUNT];
+  if (readRegisters(MCP23017_IODIRA, values, MCP23017_REGISTER_COUNT) !=
+      I2C_OK) {
+    return false;
+  }
+  memcpy(_shadow, values, MCP23017_REGISTER_COUNT);
 
-  if (result == 0) {
-    _wire->requestFrom(MCP23017_ADDRESS | i2caddr, 1);
-    while (_wire->available()) {
-      _wire->read();
-    }
+  return true;
+}
+
+/**
+ * Applies a whole configuration in two sequential writes: the output
+ * latches first, so pins that become outputs start at the right level,
+ * then IODIRA through GPPUB in one burst.
+ * @param config Configuration to apply
+ * @return true if the expander acknowledged both writes
+ */
+bool Adafruit_MCP23017::configure(const MCP23017_Config &config) {
+  // Sequential addressing in BANK=0 order is what the burst relies on
+  uint8_t iocon =
+      config.iocon & ~(MCP23017_IOCON_BANK | MCP23017_IOCON_SEQOP);
+  const uint16_t ports[] = {config.iodir,  config.ipol,
+                            config.gpinten, config.defval,
+                            config.intcon, (uint16_t)(iocon * 0x0101),
+                            config.gppu};
+  uint8_t values[sizeof(ports)];
+
+  values[0] = config.olat & 0xFF;
+  values[1] = config.olat >> 8;
+  if (writeRegisters(MCP23017_OLATA, values, 2) != I2C_OK) {
+    return false;
   }
 
-  return result == 0;
+  for (uint8_t i = 0; i < sizeof(ports) / sizeof(ports[0]); i++) {
+    values[i * 2] = ports[i] & 0xFF;
+    values[i * 2 + 1] = ports[i] >> 8;
+  }
+  return writeRegisters(MCP23017_IODIRA, values, sizeof(values)) == I2C_OK;
 }
 
 /**
  * Reads a given register
  */
 uint8_t Adafruit_MCP23017::readRegister(uint8_t addr) {
-  // read the current GPINTEN
-  _wire->beginTransmission(MCP23017_ADDRESS | i2caddr);
-  wiresend(addr, _wire);
-  _wire->endTransmission();
-  _wire->requestFrom(MCP23017_ADDRESS | i2caddr, 1);
-  return wirerecv(_wire);
+  uint8_t value = 0;
+  readRegisters(addr, &value, 1);
+  return value;
+}
+
+/**
+ * Reads count consecutive registers starting at addr
+ */
+uint8_t Adafruit_MCP23017::readRegisters(uint8_t addr, uint8_t *values,
+                                         uint8_t count) {
+  _status = _bus->transfer(MCP23017_ADDRESS | i2caddr, &addr, 1, values,
+                           count);
+  return _status;
 }
 
 /**
  * Writes a given register
  */
 void Adafruit_MCP23017::writeRegister(uint8_t regAddr, uint8_t regValue) {
-  // Write the register
-  _wire->beginTransmission(MCP23017_ADDRESS | i2caddr);
-  wiresend(regAddr, _wire);
-  wiresend(regValue, _wire);
-  _wire->endTransmission();
+  writeRegisters(regAddr, &regValue, 1);
+}
+
+/**
+ * Writes count consecutive registers starting at addr, keeping the shadow
+ * in step with what the expander acknowledged
+ */
+uint8_t Adafruit_MCP23017::writeRegisters(uint8_t addr, const uint8_t *values,
+                                          uint8_t count) {
+  uint8_t buffer[1 + MCP23017_REGISTER_COUNT];
+  if (count > MCP23017_REGISTER_COUNT) {
+    count = MCP23017_REGISTER_COUNT;
+  }
+  buffer[0] = addr;
+  memcpy(buffer + 1, values, count);
+
+  _status = _bus->transfer(MCP23017_ADDRESS | i2caddr, buffer, count + 1);
+  if (_status != I2C_OK) {
+    return _status;
+  }
+
+  for (uint8_t i = 0; i < count; i++) {
+    uint8_t regAddr = addr + i;
+    if (regAddr < MCP23017_REGISTER_COUNT) {
+      _shadow[regAddr] = values[i];
+    }
+    // IOCONA and IOCONB are the same register
+    if (regAddr == MCP23017_IOCONA || regAddr == MCP23017_IOCONB) {
+      _shadow[MCP23017_IOCONA] = _shadow[MCP23017_IOCONB] = values[i];
+    }
+  }
+  return _status;
 }
 
 /**
  * Helper to update a single bit of an A/B register.
- * - Reads the current register value
- * - Writes the new register value
+ * - Takes the current register value from the shadow
+ * - Writes the new register value, if it changed
  */
 void Adafruit_MCP23017::updateRegisterBit(uint8_t pin, uint8_t pValue,
                                           uint8_t portAaddr,
                                           uint8_t portBaddr) {
-  uint8_t regValue;
   uint8_t regAddr = regForPin(pin, portAaddr, portBaddr);
   uint8_t bit = bitForPin(pin);
-  regValue = readRegister(regAddr);
+  uint8_t regValue = _shadow[regAddr];
 
   // set the value for the particular bit
   bitWrite(regValue, bit, pValue);
 
-  writeRegister(regAddr, regValue);
+  if (regValue != _shadow[regAddr]) {
+    writeRegister(regAddr, regValue);
+  }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -130,37 +182,35 @@ void Adafruit_MCP23017::updateRegisterBit(uint8_t pin, uint8_t pValue,
  * Initializes the MCP23017 given its HW selected address, see datasheet for
  * Address selection.
  * @param addr Selected address
- * @param theWire the I2C object to use, defaults to &Wire
+ * @param bus the I2C bus to use, defaults to &I2C; it must already be begun
  */
-void Adafruit_MCP23017::begin(uint8_t addr, TwoWire *theWire) {
+void Adafruit_MCP23017::begin(uint8_t addr, I2CBus *bus) {
   if (addr > 7) {
     addr = 7;
   }
   i2caddr = addr;
-  _wire = theWire;
+  _bus = bus;
+  _status = I2C_OK;
+  _pending = I2C_NO_SLOT;
 
-  _wire->begin();
+  // power-on defaults, in case the expander can't be written below
+  memset(_shadow, 0, sizeof(_shadow));
+  _shadow[MCP23017_IODIRA] = _shadow[MCP23017_IODIRB] = 0xff;
 
   // set defaults!
-  // all inputs on port A and B
-  writeRegister(MCP23017_IODIRA, 0xff);
-  writeRegister(MCP23017_IODIRB, 0xff);
-
-  // Turn off interrupt triggers
-  writeRegister(MCP23017_GPINTENA, 0x00);
-  writeRegister(MCP23017_GPINTENB, 0x00);
-
-  // Turn off pull up resistors
-  writeRegister(MCP23017_GPPUA, 0x00);
-  writeRegister(MCP23017_GPPUB, 0x00);
+  // all inputs on port A and B, no interrupt triggers, no pull ups
+  MCP23017_Config defaults;
+  memset(&defaults, 0, sizeof(defaults));
+  defaults.iodir = 0xffff;
+  configure(defaults);
 }
 
 /**
  * Initializes the default MCP23017, with 000 for the configurable part of the
  * address
- * @param theWire the I2C object to use, defaults to &Wire
+ * @param bus the I2C bus to use, defaults to &I2C
  */
-void Adafruit_MCP23017::begin(TwoWire *theWire) { begin(0, theWire); }
+void Adafruit_MCP23017::begin(I2CBus *bus) { begin(0, bus); }
 
 /**
  * Sets the pin mode to either INPUT or OUTPUT
@@ -176,45 +226,85 @@ void Adafruit_MCP23017::pinMode(uint8_t p, uint8_t d) {
  * @return Returns the 16 bit variable representing all 16 pins
  */
 uint16_t Adafruit_MCP23017::readGPIOAB() {
-  uint16_t ba = 0;
-  uint8_t a;
+  uint8_t ba[2] = {0, 0};
 
-  // read the current GPIO output latches
-  _wire->beginTransmission(MCP23017_ADDRESS | i2caddr);
-  wiresend(MCP23017_GPIOA, _wire);
-  _wire->endTransmission();
+  // read the current GPIO of port A and B in one go
+  readRegisters(MCP23017_GPIOA, ba, 2);
 
-  _wire->requestFrom(MCP23017_ADDRESS | i2caddr, 2);
-  a = wirerecv(_wire);
-  ba = wirerecv(_wire);
-  ba <<= 8;
-  ba |= a;
-
-  return ba;
+  return ((uint16_t)ba[1] << 8) | ba[0];
 }
 
+/**
+ * Reads the values captured at the last interrupt on both ports.
+ * @return Returns the 16 bit variable representing all 16 pins
+ */
 uint16_t Adafruit_MCP23017::readINTCAPAB() {
-  uint16_t ba = 0;
-	uint8_t a;
+  uint8_t ba[2] = {0, 0};
+
+  // read the captured values of port A and B in one go
+  readRegisters(MCP23017_INTCAPA, ba, 2);
 
-	// read the current GPIO output latches
-	_wire->beginTransmission(MCP23017_ADDRESS | i2caddr);
-	wiresend(MCP23017_INTCAPA, _wire);
-	_wire->endTransmission();
+  return ((uint16_t)ba[1] << 8) | ba[0];
+}
+
+/**
+ * Reads INTF, INTCAP and GPIO of both ports in a single sequential read.
+ * Reading GPIO clears the interrupt whichever register the chip clears on.
+ * @param interrupt Filled with the flags, captured and current pin levels
+ * @return true if all registers were read
+ */
+bool Adafruit_MCP23017::readInterrupt(MCP23017_Interrupt &interrupt) {
+  uint8_t values[6];
+  if (readRegisters(MCP23017_INTFA, values, 6) != I2C_OK) {
+    return false;
+  }
+
+  interrupt.flags = ((uint16_t)values[1] << 8) | values[0];
+  interrupt.captured = ((uint16_t)values[3] << 8) | values[2];
+  interrupt.current = ((uint16_t)values[5] << 8) | values[4];
+
+  return true;
+}
+
+/**
+ * Queues the same read as readInterrupt() without waiting for it; pick the
+ * result up with collectInterrupt().
+ * @return true if the read is queued, or already was
+ */
+bool Adafruit_MCP23017::requestInterrupt() {
+  if (_pending != I2C_NO_SLOT) {
+    return true;
+  }
+
+  uint8_t addr = MCP23017_INTFA;
+  _pending = _bus->submit(MCP23017_ADDRESS | i2caddr, &addr, 1, 6,
+                          I2C_PRIORITY_HIGH);
+  return _pending != I2C_NO_SLOT;
+}
 
-	_wire->requestFrom(MCP23017_ADDRESS | i2caddr, 1);
-	a = wirerecv(_wire);
+/**
+ * Picks up the result of requestInterrupt(), if it has come in.
+ * @param interrupt Filled with the flags, captured and current pin levels
+ * @return true if the read has finished and succeeded; status() tells
+ * whether a finished read failed
+ */
+bool Adafruit_MCP23017::collectInterrupt(MCP23017_Interrupt &interrupt) {
+  if (_pending == I2C_NO_SLOT || !_bus->done(_pending)) {
+    return false;
+  }
 
-	_wire->beginTransmission(MCP23017_ADDRESS | i2caddr);
-	wiresend(MCP23017_INTCAPB, _wire);
-	_wire->endTransmission();
+  uint8_t values[6];
+  _status = _bus->collect(_pending, values);
+  _pending = I2C_NO_SLOT;
+  if (_status != I2C_OK) {
+    return false;
+  }
 
-	_wire->requestFrom(MCP23017_ADDRESS | i2caddr, 1);
-	ba = wirerecv(_wire);
-	ba <<= 8u;
-	ba |= a;
+  interrupt.flags = ((uint16_t)values[1] << 8) | values[0];
+  interrupt.captured = ((uint16_t)values[3] << 8) | values[2];
+  interrupt.current = ((uint16_t)values[5] << 8) | values[4];
 
-	return ba;
+  return true;
 }
 
 /**
@@ -223,18 +313,7 @@ uint16_t Adafruit_MCP23017::readINTCAPAB() {
  * @return Returns the b bit value of the port
  */
 uint8_t Adafruit_MCP23017::readGPIO(uint8_t b) {
-
-  // read the current GPIO output latches
-  _wire->beginTransmission(MCP23017_ADDRESS | i2caddr);
-  if (b == 0)
-    wiresend(MCP23017_GPIOA, _wire);
-  else {
-    wiresend(MCP23017_GPIOB, _wire);
-  }
-  _wire->endTransmission();
-
-  _wire->requestFrom(MCP23017_ADDRESS | i2caddr, 1);
-  return wirerecv(_wire);
+  return readRegister(b == 0 ? MCP23017_GPIOA : MCP23017_GPIOB);
 }
 
 /**
@@ -242,11 +321,9 @@ uint8_t Adafruit_MCP23017::readGPIO(uint8_t b) {
  * implementing a multiplexed matrix and want to get a decent refresh rate.
  */
 void Adafruit_MCP23017::writeGPIOAB(uint16_t ba) {
-  _wire->beginTransmission(MCP23017_ADDRESS | i2caddr);
-  wiresend(MCP23017_GPIOA, _wire);
-  wiresend(ba & 0xFF, _wire);
-  wiresend(ba >> 8, _wire);
-  _wire->endTransmission();
+  // writing the output latches is the same as writing GPIO
+  uint8_t values[2] = {(uint8_t)(ba & 0xFF), (uint8_t)(ba >> 8)};
+  writeRegisters(MCP23017_OLATA, values, 2);
 }
 
 /*!
@@ -255,19 +332,8 @@ void Adafruit_MCP23017::writeGPIOAB(uint16_t ba) {
  * @param d What to write to the pin
  */
 void Adafruit_MCP23017::digitalWrite(uint8_t pin, uint8_t d) {
-  uint8_t gpio;
-  uint8_t bit = bitForPin(pin);
-
-  // read the current GPIO output latches
-  uint8_t regAddr = regForPin(pin, MCP23017_OLATA, MCP23017_OLATB);
-  gpio = readRegister(regAddr);
-
-  // set the pin and direction
-  bitWrite(gpio, bit, d);
-
-  // write the new GPIO
-  regAddr = regForPin(pin, MCP23017_GPIOA, MCP23017_GPIOB);
-  writeRegister(regAddr, gpio);
+  // writing the output latch is the same as writing GPIO
+  updateRegisterBit(pin, d, MCP23017_OLATA, MCP23017_OLATB);
 }
 
 /*!
@@ -302,19 +368,14 @@ uint8_t Adafruit_MCP23017::digitalRead(uint8_t pin) {
  */
 void Adafruit_MCP23017::setupInterrupts(uint8_t mirroring, uint8_t openDrain,
                                         uint8_t polarity) {
-  // configure the port A
-  uint8_t ioconfValue = readRegister(MCP23017_IOCONA);
-  bitWrite(ioconfValue, 6, mirroring);
-  bitWrite(ioconfValue, 2, openDrain);
-  bitWrite(ioconfValue, 1, polarity);
-  writeRegister(MCP23017_IOCONA, ioconfValue);
-
-  // Configure the port B
-  ioconfValue = readRegister(MCP23017_IOCONB);
+  // IOCONA and IOCONB are the same register, so this configures both ports
+  uint8_t ioconfValue = _shadow[MCP23017_IOCONA];
   bitWrite(ioconfValue, 6, mirroring);
   bitWrite(ioconfValue, 2, openDrain);
   bitWrite(ioconfValue, 1, polarity);
-  writeRegister(MCP23017_IOCONB, ioconfValue);
+  if (ioconfValue != _shadow[MCP23017_IOCONA]) {
+    writeRegister(MCP23017_IOCONA, ioconfValue);
+  }
 }
 
 /**
@@ -360,20 +421,15 @@ void Adafruit_MCP23017::disableInterruptPin(uint8_t pin) {
  * @return Returns the last interrupt pin
  */
 uint8_t Adafruit_MCP23017::getLastInterruptPin() {
-  uint8_t intf;
+  MCP23017_Interrupt interrupt;
+  if (!readInterrupt(interrupt)) {
+    return MCP23017_INT_ERR;
+  }
 
-  // try port A
-  intf = readRegister(MCP23017_INTFA);
-  for (int i = 0; i < 8; i++)
-    if (bitRead(intf, i))
+  for (uint8_t i = 0; i < 16; i++)
+    if (bitRead(interrupt.flags, i))
       return i;
 
-  // try port B
-  intf = readRegister(MCP23017_INTFB);
-  for (int i = 0; i < 8; i++)
-    if (bitRead(intf, i))
-      return i + 8;
-
   return MCP23017_INT_ERR;
 }
 /*!
@@ -381,12 +437,14 @@ uint8_t Adafruit_MCP23017::getLastInterruptPin() {
  * @return Returns the value of the last interrupt pin
  */
 uint8_t Adafruit_MCP23017::getLastInterruptPinValue() {
-  uint8_t intPin = getLastInterruptPin();
-  if (intPin != MCP23017_INT_ERR) {
-    uint8_t intcapreg = regForPin(intPin, MCP23017_INTCAPA, MCP23017_INTCAPB);
-    uint8_t bit = bitForPin(intPin);
-    return (readRegister(intcapreg) >> bit) & (0x01);
+  MCP23017_Interrupt interrupt;
+  if (!readInterrupt(interrupt)) {
+    return MCP23017_INT_ERR;
   }
 
+  for (uint8_t i = 0; i < 16; i++)
+    if (bitRead(interrupt.flags, i))
+      return bitRead(interrupt.captured, i);
+
   return MCP23017_INT_ERR;
 }
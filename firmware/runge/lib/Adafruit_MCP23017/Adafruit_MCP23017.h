@@ -5,28 +5,56 @@
 #ifndef _Adafruit_MCP23017_H_
 #define _Adafruit_MCP23017_H_
 
-// Don't forget the Wire library
-#ifndef ARDUINO_AVR_GEMMA
-// TinyWireM is now part of
-//   Adafruit version of Wire Library, so this
-// will work with Adafruit ATtiny85's
-// But Arduino Gemma doesn't use that library
-// We do NOT want to include Wire if it's an arduino Gemma
-#include <Wire.h>
-#else
-#include <TinyWireM.h>
-#define Wire TinyWireM
-#endif
+#include <I2CBus.h>
+
+#define MCP23017_ADDRESS 0x20 //!< MCP23017 Address
+#define MCP23017_REGISTER_COUNT 22 //!< Registers 0x00-0x15 (BANK=0)
+
+#define MCP23017_BIT(pin) ((uint16_t)1 << (pin)) //!< Pin ID to port mask
+
+// IOCON bits
+#define MCP23017_IOCON_BANK 0x80   //!< Registers split by port
+#define MCP23017_IOCON_MIRROR 0x40 //!< INTA and INTB are ORed together
+#define MCP23017_IOCON_SEQOP 0x20  //!< Sequential addressing disabled
+#define MCP23017_IOCON_ODR 0x04    //!< INT pins are open drain
+#define MCP23017_IOCON_INTPOL 0x02 //!< INT pins are active high
+
+/*!
+ * @brief Configuration of all 16 pins, applied by configure(). Port A is the
+ * low byte of each mask, port B the high byte; fields are in register order.
+ */
+struct MCP23017_Config {
+  uint16_t iodir;   //!< 1 = input
+  uint16_t ipol;    //!< 1 = input reads inverted
+  uint16_t gpinten; //!< 1 = interrupt on change
+  uint16_t defval;  //!< compare values for pins set in intcon
+  uint16_t intcon;  //!< 1 = compare against defval, 0 = previous value
+  uint8_t iocon;    //!< MCP23017_IOCON_* bits, shared by both ports
+  uint16_t gppu;    //!< 1 = pull-up enabled
+  uint16_t olat;    //!< output levels
+};
+
+/*!
+ * @brief Interrupt state of all 16 pins, as read by readInterrupt()
+ */
+struct MCP23017_Interrupt {
+  uint16_t flags;    //!< pins that caused the interrupt (INTF)
+  uint16_t captured; //!< pin levels when it happened (INTCAP)
+  uint16_t current;  //!< pin levels now (GPIO)
+};
 
 /*!
  * @brief MCP23017 main class
  */
 class Adafruit_MCP23017 {
 public:
-  void begin(uint8_t addr, TwoWire *theWire = &Wire);
-  void begin(TwoWire *theWire = &Wire);
+  void begin(uint8_t addr, I2CBus *bus = &I2C);
+  void begin(I2CBus *bus = &I2C);
 
   bool ping();
+  uint8_t status() { return _status; } //!< I2C_* status of the last transfer
+  bool resync();
+  bool configure(const MCP23017_Config &config);
   void pinMode(uint8_t p, uint8_t d);
   void digitalWrite(uint8_t p, uint8_t d);
   void pullUp(uint8_t p, uint8_t d);
@@ -35,6 +63,9 @@ public:
   void writeGPIOAB(uint16_t);
   uint16_t readGPIOAB();
   uint16_t readINTCAPAB();
+  bool readInterrupt(MCP23017_Interrupt &interrupt);
+  bool requestInterrupt();
+  bool collectInterrupt(MCP23017_Interrupt &interrupt);
   uint8_t readGPIO(uint8_t b);
 
   void setupInterrupts(uint8_t mirroring, uint8_t open, uint8_t polarity);
@@ -45,24 +76,28 @@ public:
 
 private:
   uint8_t i2caddr;
-  TwoWire *_wire; //!< pointer to a TwoWire object
+  I2CBus *_bus; //!< pointer to the I2C bus
+  uint8_t _status; //!< status of the last transfer
+  int8_t _pending; //!< bus slot of a queued interrupt read
+  uint8_t _shadow[MCP23017_REGISTER_COUNT]; //!< last known register values
 
   uint8_t bitForPin(uint8_t pin);
   uint8_t regForPin(uint8_t pin, uint8_t portAaddr, uint8_t portBaddr);
 
   uint8_t readRegister(uint8_t addr);
   void writeRegister(uint8_t addr, uint8_t value);
+  uint8_t readRegisters(uint8_t addr, uint8_t *values, uint8_t count);
+  uint8_t writeRegisters(uint8_t addr, const uint8_t *values, uint8_t count);
 
   /**
    * Utility private method to update a register associated with a pin (whether
-   * port A/B) reads its value, updates the particular bit, and writes its
-   * value.
+   * port A/B) takes its shadowed value, updates the particular bit, and writes
+   * its value if it changed.
    */
   void updateRegisterBit(uint8_t p, uint8_t pValue, uint8_t portAaddr,
                          uint8_t portBaddr);
 };
 
-#define MCP23017_ADDRESS 0x20 //!< MCP23017 Address
 
 // registers
 #define MCP23017_IODIRA 0x00   //!< I/O direction register A
@@ -1,3 +1,5 @@
+#pragma once
+
 // Maps ATMega48/88/168/328 pins to arduino pin numbers
 
 #define PIN_PB0 8
@@ -35,3 +37,21 @@
 //#define PIN_PE5
 //#define PIN_PE6
 //#define PIN_PE7
+
+// ...and arduino pin numbers back to their port registers and bit.
+// With a compile time constant pin these fold into single
+// sbi/cbi/sbis instructions instead of digitalWrite()'s table lookups.
+#define ATMEGA328_PIN_BIT(p) \
+  ((p) < 8 ? (p) : (p) < 14 ? (p) - 8 : (p) < 22 ? (p) - 14 : (p) == 22 ? 6 : (p) - 23)
+
+#ifdef PORTE
+#define ATMEGA328_PIN_REG(p, reg) \
+  ((p) < 8 ? reg##D : (p) < 14 ? reg##B : (p) < 20 ? reg##C : (p) < 22 ? reg##B : (p) == 22 ? reg##C : reg##E)
+#else
+#define ATMEGA328_PIN_REG(p, reg) \
+  ((p) < 8 ? reg##D : (p) < 14 ? reg##B : (p) < 20 ? reg##C : (p) < 22 ? reg##B : reg##C)
+#endif
+
+#define ATMEGA328_PIN_PORT(p) ATMEGA328_PIN_REG(p, PORT)
+#define ATMEGA328_PIN_DDR(p) ATMEGA328_PIN_REG(p, DDR)
+#define ATMEGA328_PIN_PIN(p) ATMEGA328_PIN_REG(p, PIN)
@@ -52,3 +52,8 @@ bool BounceMcp::fell()
 {
     return !( state & _BV(DEBOUNCED_STATE) ) && ( state & _BV(STATE_CHANGED));
 }
+
+unsigned long BounceMcp::duration()
+{
+    return millis() - previous_millis;
+}
@@ -64,6 +64,9 @@ class BounceMcp
     // Returns the rising pin state
     bool rose();
 
+    // Returns the number of milliseconds the pin has been in the current state
+    unsigned long duration();
+
  protected:
     unsigned long previous_millis;
     uint16_t interval_millis;
@@ -13,6 +13,10 @@
 
 
 #include "HX711.h"
+#include "HX711Filter.h"
+
+// keeps the compiler from moving buffer accesses across head/tail updates
+#define HX711_BARRIER()  __asm__ __volatile__ ("" ::: "memory")
 
 HX711::HX711()
 {
@@ -31,13 +35,18 @@ void HX711::begin(uint8_t dataPin, uint8_t clockPin)
   digitalWrite(_clockPin, LOW);
 
   reset();
+  _powered = true;
+  _lastRead = millis();
+  _lastSample = _lastRead;
 }
 
 void HX711::reset()
 {
   _offset = 0;
   _scale = 1;
+  _scale_q20 = 1000L << 20;
   _gain = 128;
+  _secondaryCount = 0;
 }
 
 bool HX711::is_ready()
@@ -48,27 +57,32 @@ bool HX711::is_ready()
 float HX711::read() 
 {
   // this waiting takes most time...
-  while (digitalRead(_dataPin) == HIGH) yield();
-  
+  while (!is_ready()) yield();
+
+  noInterrupts();
+  _next_gain = _gain;
+  long value = _shift_in();
+  _advance_gain();
+  interrupts();
+
+  _lastRead = millis();
+  return 1.0 * value;
+}
+
+long HX711::_shift_in()
+{
   union
   {
     long value = 0;
     uint8_t data[4];
   } v;
 
-  noInterrupts();
-
   // Pulse the clock pin 24 times to read the data.
   v.data[2] = shiftIn(_dataPin, _clockPin, MSBFIRST);
   v.data[1] = shiftIn(_dataPin, _clockPin, MSBFIRST);
   v.data[0] = shiftIn(_dataPin, _clockPin, MSBFIRST);
 
-  // TABLE 3 page 4 datasheet
-  // only default verified, so other values not supported yet
-  uint8_t m = 1;   // default gain == 128
-  if (_gain == 64) m = 3;
-  if (_gain == 32) m = 2;
-
+  uint8_t m = _gain_pulses();
   while (m > 0)
   {
     digitalWrite(_clockPin, HIGH);
@@ -76,19 +90,293 @@ float HX711::read()
     m--;
   }
 
-  interrupts();
-
   // SIGN extend
   if (v.data[2] & 0x80) v.data[3] = 0xFF;
 
+  return v.value;
+}
+
+uint8_t HX711::_gain_pulses()
+{
+  // TABLE 3 page 4 datasheet
+  // 25 pulses channel A 128, 26 channel B 32, 27 channel A 64
+  uint8_t m = 1;   // default gain == 128
+  if (_next_gain == 64) m = 3;
+  if (_next_gain == 32) m = 2;
+  return m;
+}
+
+uint8_t HX711::_advance_gain()
+{
+  uint8_t gain = _cur_gain;
+  if (_cur_age < HX711_SETTLE_CONVERSIONS) gain = 0;
+
+  // the pulses just sent selected the gain of the conversion now starting
+  if (_next_gain != _cur_gain)
+  {
+    _cur_gain = _next_gain;
+    _cur_age = 0;
+  }
+  else if (_cur_age < 255) _cur_age++;
+  return gain;
+}
+
+uint8_t HX711::_schedule()
+{
+  if (_secondaryCount == 0) return _gain;
+
+  // phases include the settling conversions of their switch
+  if (--_phaseLeft == 0)
+  {
+    _phase = !_phase;
+    _phaseLeft = (_phase ? _secondaryCount : _primaryCount) + HX711_SETTLE_CONVERSIONS;
+  }
+  return _phase ? _secondaryGain : _gain;
+}
+
+void HX711::set_schedule(uint8_t primary_count, uint8_t secondary_gain, uint8_t secondary_count)
+{
+  noInterrupts();
+  _primaryCount = primary_count > 0 ? primary_count : 1;
+  _secondaryGain = secondary_gain;
+  _secondaryCount = secondary_count;
+  _phase = false;
+  _phaseLeft = _primaryCount + HX711_SETTLE_CONVERSIONS;
+  interrupts();
+}
+
+bool HX711::begin_interrupt()
+{
+#ifdef digitalPinToPCICR
+  if (digitalPinToPCICR(_dataPin) == 0) return false;
+
+  noInterrupts();
+  _head = 0;
+  _tail = 0;
+  _overruns = 0;
+  *digitalPinToPCMSK(_dataPin) |= _BV(digitalPinToPCMSKbit(_dataPin));
+  PCIFR = _BV(digitalPinToPCICRbit(_dataPin));
+  *digitalPinToPCICR(_dataPin) |= _BV(digitalPinToPCICRbit(_dataPin));
+  _interrupt = true;
+  // a conversion that is already waiting produces no edge
+  handle_interrupt();
+  interrupts();
+  return true;
+#else
+  return false;
+#endif
+}
+
+void HX711::end_interrupt()
+{
+#ifdef digitalPinToPCICR
+  if (digitalPinToPCICR(_dataPin) == 0) return;
+  // leave PCICR alone, other pins may share the vector
+  *digitalPinToPCMSK(_dataPin) &= ~_BV(digitalPinToPCMSKbit(_dataPin));
+  _interrupt = false;
+#endif
+}
+
+void HX711::handle_interrupt()
+{
+  // pin change fires on both edges; powered down, DOUT may still fall
+  // while SCK is held high, clocking then would wake the part
+  if (!_powered || !is_ready()) return;
+
+  _next_gain = _schedule();
+  long value = _shift_in();
+  uint8_t gain = _advance_gain();
   _lastRead = millis();
-  return 1.0 * v.value;
+
+#ifdef digitalPinToPCICR
+  // clocking the bits out toggled DOUT, drop those pin changes
+  PCIFR = _BV(digitalPinToPCICRbit(_dataPin));
+#endif
+
+  uint8_t head = _head;
+  if ((uint8_t)(head - _tail) == HX711_BUFFER_SIZE)
+  {
+    _overruns++;
+    return;
+  }
+  HX711_sample &slot = _buffer[head & (HX711_BUFFER_SIZE - 1)];
+  slot.value = value;
+  slot.time = _lastRead;
+  slot.gain = gain;
+  HX711_BARRIER();
+  _head = head + 1;
+}
+
+bool HX711::read_sample(HX711_sample &sample)
+{
+  while (true)
+  {
+    uint8_t tail = _tail;
+    if (tail == _head) return false;
+
+    HX711_BARRIER();
+    sample = _buffer[tail & (HX711_BUFFER_SIZE - 1)];
+    HX711_BARRIER();
+    _tail = tail + 1;
+
+    // count the conversions that should have come in between
+    uint32_t gap = sample.time - _lastSample;
+    _lastSample = sample.time;
+    if (gap > _conversionTime + _conversionTime / 2)
+    {
+      _missed += (gap + _conversionTime / 2) / _conversionTime - 1;
+    }
+
+    // settling after a gain change
+    if (sample.gain == 0) continue;
+
+    if (sample.gain == _gain)
+    {
+      if (_filter != NULL) _filter->add(sample.value);
+      if (_zero_enabled) _track_zero(sample.value);
+    }
+    return true;
+  }
+}
+
+void HX711::set_zero_tracking(uint16_t band, uint16_t noise, uint8_t shift)
+{
+  _zero_band = band;
+  _zero_noise = noise;
+  _zero_shift = shift;
+  _zero_count = 0;
+}
+
+void HX711::enable_zero_tracking(bool enable)
+{
+  if (enable == _zero_enabled) return;
+  _zero_enabled = enable;
+  _zero_count = 0;
+}
+
+void HX711::_track_zero(int32_t value)
+{
+  if (_zero_count == 0)
+  {
+    _zero_sum = 0;
+    _zero_min = value;
+    _zero_max = value;
+  }
+  if (value < _zero_min) _zero_min = value;
+  if (value > _zero_max) _zero_max = value;
+  _zero_sum += value;
+  if (++_zero_count < HX711_ZERO_WINDOW) return;
+  _zero_count = 0;
+
+  // platform is moving
+  if (_zero_max - _zero_min > _zero_noise) return;
+
+  int32_t mean = _zero_sum / HX711_ZERO_WINDOW;
+  if (_offset == 0)
+  {
+    _offset = mean;
+    return;
+  }
+
+  // something is on the platform
+  int32_t drift = mean - _offset;
+  if (drift > _zero_band || drift < -(int32_t)_zero_band) return;
+
+  int32_t step = drift / (1L << _zero_shift);
+  if (step == 0) step = (drift > 0) - (drift < 0);
+  _offset += step;
+}
+
+uint8_t HX711::poll()
+{
+  if (!_powered) return HX711_IDLE;
+
+  if (!_interrupt && is_ready())
+  {
+    noInterrupts();
+    handle_interrupt();
+    interrupts();
+  }
+  if (available() > 0) return HX711_SAMPLE_READY;
+
+  noInterrupts();
+  uint32_t lastRead = _lastRead;
+  interrupts();
+  if (millis() - lastRead > (uint32_t)_conversionTime * HX711_TIMEOUT_CONVERSIONS)
+  {
+    return HX711_TIMEOUT;
+  }
+  return HX711_CONVERTING;
+}
+
+int32_t HX711::get_filtered()
+{
+  if (_filter == NULL) return 0;
+  return _filter->value();
+}
+
+int32_t HX711::read_raw()
+{
+  while (!is_ready()) yield();
+
+  noInterrupts();
+  _next_gain = _gain;
+  long value = _shift_in();
+  _advance_gain();
+  interrupts();
+
+  _lastRead = millis();
+  return value;
 }
 
 // assumes tare() has been set.
 void HX711::callibrate_scale(uint16_t weight, uint8_t times)
 {
   _scale = (1.0 * weight) / (read_average(times) - _offset);
+  _scale_q20 = _to_q20(_scale);
+}
+
+// assumes tare() has been set.
+void HX711::callibrate_scale_mg(uint32_t weight, uint8_t times)
+{
+  int32_t value = read_average_raw(times) - _offset;
+  if (value == 0) return;
+  set_scale_q20((((int64_t)weight << 20) + value / 2) / value);
+}
+
+void HX711::set_scale(float scale)
+{
+  _scale = 1 / scale;
+  _scale_q20 = _to_q20(_scale);
+}
+
+int32_t HX711::_to_q20(float units_per_count)
+{
+  double q = units_per_count * 1048576000.0;
+  // outside Q12.20 the cast would be undefined, saturate instead
+  if (q >= 2147483647.0)  return HX711_Q20_MAX;
+  if (q <= -2147483647.0) return -HX711_Q20_MAX;
+  // half away from zero, the same both sides
+  return (int32_t)(q < 0 ? q - 0.5 : q + 0.5);
+}
+
+void HX711::set_scale_q20(int32_t mg_per_count)
+{
+  _scale_q20 = mg_per_count;
+  // no float division here, integer only sketches never link it
+  _scale = 0;
+}
+
+float HX711::_float_scale()
+{
+  if (_scale == 0) _scale = _scale_q20 / 1048576000.0;
+  return _scale;
+}
+
+int32_t HX711::to_mg(int32_t value)
+{
+  // 24 bit value * 32 bit scale needs the wide multiply, rounded
+  return ((int64_t)value * _scale_q20 + 0x80000) >> 20;
 }
 
 void HX711::wait_ready(uint32_t ms) 
@@ -131,14 +419,29 @@ float HX711::read_average(uint8_t times)
   return sum / times;
 }
 
+int32_t HX711::read_average_raw(uint8_t times)
+{
+  // 24 bit values, so 255 of them fit in 32 bits
+  int32_t sum = 0;
+  for (uint8_t i = 0; i < times; i++)
+  {
+    sum += read_raw();
+    yield();
+  }
+  if (sum < 0) return (sum - times / 2) / times;
+  return (sum + times / 2) / times;
+}
+
 float HX711::get_units(uint8_t times)
 {
-  float units = get_value(times) * _scale;
+  float units = get_value(times) * _float_scale();
   return units;
 };
 
 void HX711::power_down() 
 {
+  // before SCK goes high, see handle_interrupt()
+  _powered = false;
   digitalWrite(_clockPin, LOW);
   digitalWrite(_clockPin, HIGH);
 }
@@ -146,6 +449,14 @@ void HX711::power_down()
 void HX711::power_up() 
 {
   digitalWrite(_clockPin, LOW);
+  _powered = true;
+  // the first conversion takes the settling time again, at A 128
+  noInterrupts();
+  _lastRead = millis();
+  _cur_gain = 128;
+  _cur_age = 0;
+  interrupts();
+  _lastSample = _lastRead;
 }
 
 // -- END OF FILE --
@@ -17,19 +17,60 @@
 
 #define HX711_LIB_VERSION  (F("0.2.1"))
 
+// number of samples the interrupt driven acquisition can hold
+// must be a power of 2
+#ifndef HX711_BUFFER_SIZE
+#define HX711_BUFFER_SIZE  8
+#endif
+
+class HX711Filter;
+
+// samples per zero tracking window, 1.6 s at 10 SPS
+#ifndef HX711_ZERO_WINDOW
+#define HX711_ZERO_WINDOW  16
+#endif
+
+// conversions without a sample before poll() reports a timeout
+#ifndef HX711_TIMEOUT_CONVERSIONS
+#define HX711_TIMEOUT_CONVERSIONS  5
+#endif
+
+// conversions dropped after a gain / channel change before the
+// output is trusted again. datasheet note 2 gives 4 at 10 SPS for a
+// full step response, the first one is the one that is way off.
+#ifndef HX711_SETTLE_CONVERSIONS
+#define HX711_SETTLE_CONVERSIONS  1
+#endif
+
+// largest Q12.20 scale, just under 2048 thousandths of a unit per count
+#define HX711_Q20_MAX  0x7FFFFFFFL
+
+// poll() results
+#define HX711_IDLE          0
+#define HX711_CONVERTING    1
+#define HX711_SAMPLE_READY  2
+#define HX711_TIMEOUT       3
+
+// one conversion, timestamped in millis()
+struct HX711_sample
+{
+  long     value;
+  uint32_t time;
+  uint8_t  gain;        // 128, 64 = channel A, 32 = channel B
+};
+
 class HX711
 {
 public:
   HX711();
   ~HX711();
 
-  // fixed gain 128 for now
   void     begin(uint8_t dataPin, uint8_t clockPin);
 
   void     reset();
 
   // checks if loadcell is ready to read.
-  bool     is_ready();
+  virtual bool is_ready();
   
   // wait until ready, 
   // check every ms
@@ -48,19 +89,48 @@ public:
   // converted to proper units.
   float    get_units(uint8_t times = 1);
 
+  // INTEGER API
+  // same pipeline without floating point, scale kept as Q12.20
+  // thousandths of a unit (mg if calibrated in grams) per count.
+  int32_t  read_raw();
+  int32_t  read_average_raw(uint8_t times = 10);
+  int32_t  get_value_raw(uint8_t times = 1) { return read_average_raw(times) - _offset; };
+  // in thousandths of a unit
+  int32_t  get_units_mg(uint8_t times = 1)  { return to_mg(get_value_raw(times)); };
+  // converts an offset corrected value to thousandths of a unit
+  // within one count of the float path for |value| < 2 * scale_q20
+  int32_t  to_mg(int32_t value);
+
   // TARE
   // call tare to calibrate zero
   void     tare(uint8_t times = 10)     { _offset = read_average(times); };
-  float    get_tare()                   { return -_offset * _scale; };
+  float    get_tare()                   { return -_offset * _float_scale(); };
   bool     tare_set()                   { return _offset != 0; };
 
+  // ZERO TRACKING
+  // follows the drift of an empty, stable platform by nudging the offset
+  // 1 / 2^shift of the way each window, fed by read_sample().
+  // band : max distance from zero in counts still taken as empty
+  // noise: max spread over a window in counts still taken as stable
+  // without an offset set, the first stable window becomes zero.
+  void     set_zero_tracking(uint16_t band, uint16_t noise, uint8_t shift = 3);
+  void     enable_zero_tracking(bool enable);
+  bool     zero_tracking()              { return _zero_enabled; };
+
   // CORE "CONSTANTS" -> read datasheet
-  // GAIN values: 128, 64 32  [only 128 tested & verified]
+  // GAIN values: 128, 64 = channel A, 32 = channel B
+  // takes effect from the conversion after the next one
   void     set_gain(uint8_t gain = 128) { _gain = gain; };
   uint8_t  get_gain()                   { return _gain; };
   // SCALE > 0
-  void     set_scale(float scale = 1.0) { _scale = 1 / scale; };
-  float    get_scale()                  { return 1 / _scale; };
+  void     set_scale(float scale = 1.0);
+  float    get_scale()                  { return 1 / _float_scale(); };
+  // Q12.20 thousandths of a unit per count, e.g. from EEPROM. covers
+  // |mg_per_count| < 2048, i.e. |scale| above ~0.49 counts per unit;
+  // set_scale() and callibrate_scale() saturate the integer scale at
+  // +-HX711_Q20_MAX outside that, the float API keeps the exact value.
+  void     set_scale_q20(int32_t mg_per_count);
+  int32_t  get_scale_q20()              { return _scale_q20; };
   // OFFSET > 0
   void     set_offset(long offset = 0)  { _offset = offset; };
   long     get_offset()                 { return _offset; };
@@ -72,6 +142,8 @@ public:
   // call callibrate_scale(weight) 
   // scale is calculated.
   void     callibrate_scale(uint16_t weight, uint8_t times = 10);
+  // idem, weight in thousandths of a unit, integer only
+  void     callibrate_scale_mg(uint32_t weight, uint8_t times = 10);
 
   // POWER MANAGEMENT
   void     power_down();
@@ -80,20 +152,110 @@ public:
   // TIME OF LAST READ
   uint32_t last_read()                  { return _lastRead; };
 
+  // INTERRUPT DRIVEN ACQUISITION
+  // enables a pin change interrupt on dataPin, the sketch must call
+  // handle_interrupt() from the matching PCINTn_vect.
+  // do not mix with read() while enabled.
+  bool     begin_interrupt();
+  void     end_interrupt();
+  // clocks a finished conversion into the sample buffer, ISR context
+  void     handle_interrupt();
+  // number of samples waiting in the buffer
+  uint8_t  available()                  { return (uint8_t)(_head - _tail); };
+  // pops the oldest sample, returns false if there is none
+  bool     read_sample(HX711_sample &sample);
+  // samples dropped because the buffer was full
+  uint16_t overruns()                   { return _overruns; };
+
+  // NON BLOCKING
+  // returns one of HX711_IDLE (powered down), HX711_CONVERTING,
+  // HX711_SAMPLE_READY (read_sample() has data) or HX711_TIMEOUT.
+  // without the interrupt a finished conversion is clocked into the
+  // sample buffer here, it never waits.
+  uint8_t  poll();
+  // conversion period set by the RATE pin, 100 ms at 10 SPS
+  void     set_conversion_time(uint16_t ms = 100) { _conversionTime = ms; };
+  // conversions that never showed up in read_sample()
+  uint16_t missed_conversions()         { return _missed; };
+
+  // CHANNEL SCHEDULING
+  // interleaves primary_count conversions at get_gain() with
+  // secondary_count at secondary_gain, e.g. channel B at 32.
+  // samples carry their gain; the settling conversions after each
+  // switch are dropped, so (a + b) / (a + b + 2 * HX711_SETTLE_CONVERSIONS)
+  // of the conversions arrive. secondary_count 0 stops interleaving.
+  void     set_schedule(uint8_t primary_count, uint8_t secondary_gain, uint8_t secondary_count);
+
+  // STREAMING FILTER
+  // every sample at get_gain() popped by read_sample() is fed to the filter, see HX711Filter.h
+  void     set_filter(HX711Filter *filter) { _filter = filter; };
+  // filtered raw value, does not wait for a conversion
+  int32_t  get_filtered();
+  // filtered, offset corrected and converted to thousandths of a unit
+  int32_t  get_filtered_mg()            { return to_mg(get_filtered() - _offset); };
+
   // PRICING  (idem calories?)
   float    get_price(uint8_t times = 1) { return get_units(times) * _price; };
   void     set_unit_price(float price)  { _price = price; };
   float    get_unit_price()             { return _price; };
 
+protected:
+  // clocks out 24 bits + gain pulses, interrupts must be off
+  virtual long _shift_in();
+  // extra clock pulses after the data that select _next_gain
+  uint8_t  _gain_pulses();
+  uint8_t  _schedule();
+  // bookkeeping after clocking out a conversion, returns its gain or 0
+  // if it is still settling from a gain change
+  uint8_t  _advance_gain();
+
+  uint8_t  _next_gain = 128;
+  void     _track_zero(int32_t value);
+  // units per count, worked out from _scale_q20 the first time the
+  // float API needs it after set_scale_q20()
+  float    _float_scale();
+  // units per count as Q12.20 thousandths, rounded and saturated
+  static int32_t _to_q20(float units_per_count);
+
 private:
   uint8_t  _dataPin;
   uint8_t  _clockPin;
 
   uint8_t  _gain     = 128;     // default channel A
   long     _offset   = 0;
-  float    _scale    = 1;
+  float    _scale    = 1;       // 0 until derived from _scale_q20
+  int32_t  _scale_q20 = 1000L << 20;
   uint32_t _lastRead = 0;
+  volatile bool _powered = false;  // read by handle_interrupt()
+  bool     _interrupt = false;
+  uint16_t _conversionTime = 100;
+  uint16_t _missed   = 0;
+  uint32_t _lastSample = 0;
+
+  uint8_t  _cur_gain  = 128;    // conversion in progress
+  uint8_t  _cur_age   = HX711_SETTLE_CONVERSIONS;
+  uint8_t  _primaryCount   = 0;
+  uint8_t  _secondaryGain  = 32;
+  uint8_t  _secondaryCount = 0;
+  uint8_t  _phaseLeft = 0;
+  bool     _phase     = false;  // secondary
   float    _price    = 0;
+  HX711Filter *_filter = NULL;
+
+  bool     _zero_enabled = false;
+  uint16_t _zero_band    = 0;
+  uint16_t _zero_noise   = 0;
+  uint8_t  _zero_shift   = 3;
+  uint8_t  _zero_count   = 0;
+  int32_t  _zero_sum     = 0;
+  int32_t  _zero_min     = 0;
+  int32_t  _zero_max     = 0;
+
+  // single producer (ISR) single consumer (loop) ring buffer
+  HX711_sample      _buffer[HX711_BUFFER_SIZE];
+  volatile uint8_t  _head     = 0;
+  volatile uint8_t  _tail     = 0;
+  volatile uint16_t _overruns = 0;
 };
 
 // -- END OF FILE --
@@ -0,0 +1,86 @@
+#pragma once
+//
+//    FILE: HX711Fast.h
+// PURPOSE: HX711 with compile time pins and direct port I/O
+//
+// NOTES
+// Same interface as HX711, but the pins are template parameters so every
+// clock edge is a single sbi/cbi. Clocking out a conversion with interrupts
+// off takes ~30 us at 8 MHz instead of several hundred with shiftIn().
+// AVR only, see Atmega328Pins.h for the pin mapping.
+
+
+#include "HX711.h"
+
+#if defined(__AVR__)
+
+#include <Atmega328Pins.h>
+
+template <uint8_t DataPin, uint8_t ClockPin>
+class HX711Fast : public HX711
+{
+public:
+  void     begin()                      { HX711::begin(DataPin, ClockPin); };
+
+  bool     is_ready()
+  {
+    return (ATMEGA328_PIN_PIN(DataPin) & _BV(ATMEGA328_PIN_BIT(DataPin))) == 0;
+  };
+
+protected:
+  long     _shift_in()
+  {
+    union
+    {
+      long value = 0;
+      uint8_t data[4];
+    } v;
+
+    v.data[2] = _shift_byte();
+    v.data[1] = _shift_byte();
+    v.data[0] = _shift_byte();
+
+    uint8_t m = _gain_pulses();
+    while (m > 0)
+    {
+      _clock_high();
+      _clock_low();
+      m--;
+    }
+
+    // SIGN extend
+    if (v.data[2] & 0x80) v.data[3] = 0xFF;
+
+    return v.value;
+  };
+
+private:
+  static inline void _clock_high()
+  {
+    ATMEGA328_PIN_PORT(ClockPin) |= _BV(ATMEGA328_PIN_BIT(ClockPin));
+    // PD_SCK high >= 0.2 us, DOUT valid 0.1 us after the rising edge
+    __builtin_avr_delay_cycles(F_CPU / 5000000UL + 1);
+  };
+
+  static inline void _clock_low()
+  {
+    ATMEGA328_PIN_PORT(ClockPin) &= ~_BV(ATMEGA328_PIN_BIT(ClockPin));
+  };
+
+  static inline uint8_t _shift_byte()
+  {
+    uint8_t value = 0;
+    for (uint8_t i = 0; i < 8; i++)
+    {
+      _clock_high();
+      value <<= 1;
+      if (ATMEGA328_PIN_PIN(DataPin) & _BV(ATMEGA328_PIN_BIT(DataPin))) value |= 1;
+      _clock_low();
+    }
+    return value;
+  };
+};
+
+#endif
+
+// -- END OF FILE --
@@ -0,0 +1,206 @@
+#pragma once
+//
+//    FILE: HX711Filter.h
+// PURPOSE: Streaming filters for HX711 samples
+//
+// NOTES
+// Each filter takes one raw sample at a time and keeps its estimate
+// current, so reading it never waits for conversions the way
+// read_average() does. Memory is fixed by the template parameters.
+// Attach one with HX711::set_filter(), the driver feeds it every
+// sample handed out by read_sample().
+
+
+#include "Arduino.h"
+
+class HX711Filter
+{
+public:
+  virtual void    add(int32_t value) = 0;
+  // current estimate, 0 until the first sample
+  virtual int32_t value() = 0;
+  virtual void    reset() = 0;
+};
+
+
+// mean of the last N samples, O(1)
+template <uint8_t N>
+class HX711MovingAverage : public HX711Filter
+{
+public:
+  void add(int32_t value)
+  {
+    if (_count < N) _count++;
+    else _sum -= _window[_index];
+    _window[_index] = value;
+    _sum += value;
+    if (++_index == N) _index = 0;
+  };
+
+  int32_t value()
+  {
+    if (_count == 0) return 0;
+    if (_sum < 0) return (_sum - _count / 2) / _count;
+    return (_sum + _count / 2) / _count;
+  };
+
+  void reset()                          { _count = 0; _index = 0; _sum = 0; };
+
+private:
+  // 24 bit samples, so up to 255 of them fit the sum
+  static_assert(N > 0 && N < 256, "HX711MovingAverage: 0 < N < 256");
+
+  int32_t _window[N];
+  int32_t _sum   = 0;
+  uint8_t _index = 0;
+  uint8_t _count = 0;
+};
+
+
+// median of the last N samples, rejects single outliers
+// the window is kept sorted, the leaving sample is found in O(log N)
+// and only the entries between its rank and the new one are moved.
+template <uint8_t N>
+class HX711Median : public HX711Filter
+{
+public:
+  void add(int32_t value)
+  {
+    uint8_t pos;
+    if (_count < N)
+    {
+      pos = _count++;
+      while (pos > 0 && _sorted[pos - 1] > value)
+      {
+        _sorted[pos] = _sorted[pos - 1];
+        pos--;
+      }
+    }
+    else
+    {
+      pos = _find(_window[_index]);
+      while (pos + 1 < N && _sorted[pos + 1] < value)
+      {
+        _sorted[pos] = _sorted[pos + 1];
+        pos++;
+      }
+      while (pos > 0 && _sorted[pos - 1] > value)
+      {
+        _sorted[pos] = _sorted[pos - 1];
+        pos--;
+      }
+    }
+    _sorted[pos] = value;
+    _window[_index] = value;
+    if (++_index == N) _index = 0;
+  };
+
+  int32_t value()
+  {
+    if (_count == 0) return 0;
+    return _sorted[(_count - 1) / 2];
+  };
+
+  void reset()                          { _count = 0; _index = 0; };
+
+private:
+  static_assert(N > 0, "HX711Median: N > 0");
+
+  // position of value in the (full) sorted window
+  uint8_t _find(int32_t value)
+  {
+    uint8_t lo = 0;
+    uint8_t hi = N - 1;
+    while (lo < hi)
+    {
+      uint8_t mid = (lo + hi) / 2;
+      if (_sorted[mid] < value) lo = mid + 1;
+      else hi = mid;
+    }
+    return lo;
+  };
+
+  int32_t _window[N];   // arrival order
+  int32_t _sorted[N];
+  uint8_t _index = 0;
+  uint8_t _count = 0;
+};
+
+
+// exponential smoothing with alpha = 1 / 2^SHIFT, O(1)
+template <uint8_t SHIFT>
+class HX711Exponential : public HX711Filter
+{
+public:
+  void add(int32_t value)
+  {
+    if (!_primed)
+    {
+      _acc = value * (1L << SHIFT);
+      _primed = true;
+      return;
+    }
+    _acc += value - (_acc >> SHIFT);
+  };
+
+  int32_t value()
+  {
+    return (_acc + (1L << SHIFT >> 1)) >> SHIFT;
+  };
+
+  void reset()                          { _acc = 0; _primed = false; };
+
+private:
+  // 24 bit samples plus SHIFT fraction bits
+  static_assert(SHIFT < 8, "HX711Exponential: SHIFT < 8");
+
+  int32_t _acc    = 0;
+  bool    _primed = false;
+};
+
+
+// scalar Kalman filter for a (slowly) constant weight, O(1)
+// q = process noise, r = measurement noise, both variances in counts^2
+class HX711Kalman : public HX711Filter
+{
+public:
+  HX711Kalman(uint32_t q, uint32_t r) : _q(q), _r(r) {};
+
+  void add(int32_t value)
+  {
+    if (!_primed)
+    {
+      _x = value;
+      _p = _r;
+      _primed = true;
+      return;
+    }
+    uint32_t p = _p + _q;
+    // gain in Q16, scale p and p + r down until the division fits 32 bits
+    uint32_t pn = p;
+    uint32_t sn = p + _r;
+    while (sn > 0xFFFF)
+    {
+      pn >>= 1;
+      sn >>= 1;
+    }
+    uint32_t k = sn ? (pn << 16) / sn : 0;
+    _x += ((int64_t)(value - _x) * k + 0x8000) >> 16;
+    _p = ((uint64_t)p * (0x10000 - k)) >> 16;
+  };
+
+  int32_t value()                       { return _x; };
+
+  void reset()                          { _x = 0; _p = 0; _primed = false; };
+
+  void set_noise(uint32_t q, uint32_t r) { _q = q; _r = r; };
+
+private:
+  uint32_t _q;
+  uint32_t _r;
+  int32_t  _x      = 0;
+  uint32_t _p      = 0;
+  bool     _primed = false;
+};
+
+// -- END OF FILE --
@@ -0,0 +1,89 @@
+//
+//    FILE: HX_fixed_point.ino
+//  AUTHOR: Rob Tillaart
+// VERSION: 0.1.0
+// PURPOSE: HX711 demo, float vs integer conversion cost
+//     URL: https://github.com/RobTillaart/HX711
+//
+// HISTORY:
+// 0.1.0    2026-10-17 initial version
+//
+
+#include "HX711.h"
+
+HX711 scale;
+
+uint8_t dataPin = 6;
+uint8_t clockPin = 7;
+
+uint32_t start, stop;
+volatile long raw;
+volatile float f;
+volatile int32_t mg;
+
+void setup()
+{
+  Serial.begin(115200);
+  Serial.println(__FILE__);
+  Serial.print("LIBRARY VERSION: ");
+  Serial.println(HX711_LIB_VERSION);
+  Serial.println();
+
+  scale.begin(dataPin, clockPin);
+
+  // loadcell factor 5 KG
+  scale.set_scale(420.0983);
+  scale.set_offset(-12345);
+
+  // only the conversion is timed, not the 100 ms conversion wait
+  raw = 84123;
+  long offset = scale.get_offset();
+  float units = 1.0 / scale.get_scale();
+
+  Serial.println("\nFLOAT  (value - offset) * scale");
+  start = micros();
+  for (int i = 0; i < 1000; i++)
+  {
+    f = (1.0 * raw - offset) * units;
+  }
+  stop = micros();
+  report(stop - start);
+  Serial.print("  VAL: ");
+  Serial.println(f, 3);
+
+  Serial.println("\nINTEGER  to_mg(value - offset)");
+  start = micros();
+  for (int i = 0; i < 1000; i++)
+  {
+    mg = scale.to_mg(raw - offset);
+  }
+  stop = micros();
+  report(stop - start);
+  Serial.print("  VAL: ");
+  Serial.println(mg);
+
+  Serial.println("\nMAX DIFFERENCE IN COUNTS");
+  float maxDiff = 0;
+  for (long v = -4000000; v < 4000000; v += 9973)
+  {
+    float diff = fabs(v * units * 1000.0 - scale.to_mg(v)) / (1000.0 * units);
+    if (diff > maxDiff) maxDiff = diff;
+  }
+  Serial.println(maxDiff, 3);
+}
+
+void loop()
+{
+}
+
+void report(uint32_t duration)
+{
+  // includes loop overhead, identical for both
+  Serial.print("1000x = ");
+  Serial.print(duration);
+  Serial.print(" us, cycles per call: ");
+  Serial.println(duration * clockCyclesPerMicrosecond() / 1000);
+}
+
+
+// -- END OF FILE --
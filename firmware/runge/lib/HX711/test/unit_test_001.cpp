@@ -26,12 +26,31 @@
 
 #include "Arduino.h"
 #include "HX711.h"
+#include "HX711Filter.h"
 
 
 uint8_t dataPin = 6;
 uint8_t clockPin = 7;
 
 
+// numbers the conversions it clocks out, and notes the gain pulses
+// each one was read out with
+class ScheduledHX711 : public HX711
+{
+public:
+  long    conversions = 0;
+  uint8_t pulses[16];
+
+protected:
+  long _shift_in()
+  {
+    HX711::_shift_in();
+    pulses[conversions] = _gain_pulses();
+    return ++conversions;
+  }
+};
+
+
 unittest_setup()
 {
 }
@@ -88,6 +107,45 @@ unittest(test_scale)
 }
 
 
+unittest(test_scale_q20)
+{
+  HX711 scale;
+  scale.begin(dataPin, clockPin);
+
+  assertEqual(1000L << 20, scale.get_scale_q20());
+  assertEqual(-5000, scale.to_mg(-5));
+
+  scale.set_scale(420.0983);
+  assertEqualFloat(420.0983, scale.get_scale(), 0.001);
+
+  // integer path matches the float path within one count
+  // over the full output of a 5 KG loadcell and then some
+  float countMg = 1000.0 / 420.0983;
+  for (long v = -4000000; v < 4000000; v += 99991)
+  {
+    float mg = v * 1000.0 / 420.0983;
+    assertEqualFloat(mg, scale.to_mg(v), countMg);
+  }
+
+  // rounds the same way either side of zero
+  scale.set_scale(-420.0983);
+  assertEqual(-2496025, scale.get_scale_q20());
+  scale.set_scale(420.0983);
+  assertEqual(2496025, scale.get_scale_q20());
+
+  // 10 units per count doesn't fit Q12.20, saturates
+  scale.set_scale(0.1);
+  assertEqual(HX711_Q20_MAX, scale.get_scale_q20());
+  assertEqualFloat(0.1, scale.get_scale(), 0.001);
+  scale.set_scale(-0.1);
+  assertEqual(-HX711_Q20_MAX, scale.get_scale_q20());
+
+  scale.set_scale_q20(2496000);
+  assertEqual(2496000, scale.get_scale_q20());
+  assertEqualFloat(420.1026, scale.get_scale(), 0.001);
+}
+
+
 unittest(test_offset)
 {
   HX711 scale;
@@ -135,6 +193,133 @@ unittest(test_unit_price)
 }
 
 
+unittest(test_schedule)
+{
+  GodmodeState* state = GODMODE();
+  state->reset();
+
+  ScheduledHX711 scale;
+  scale.begin(dataPin, clockPin);
+  scale.set_gain(128);
+  // 2 on channel A, 1 on channel B, each after one settling conversion
+  scale.set_schedule(2, 32, 1);
+
+  // busy converting: nothing is clocked out
+  state->digitalPin[dataPin] = HIGH;
+  scale.handle_interrupt();
+  assertEqual(0, scale.conversions);
+  state->digitalPin[dataPin] = LOW;
+
+  // the pulses after conversion n select the gain of conversion n + 1
+  uint8_t expectPulses[] = { 1, 1, 2, 2, 1, 1, 1, 2, 2, 1 };
+  // sample values are conversion numbers, 0 = dropped while settling
+  long expectA[] = { 1, 2, 3, 0, 0, 0, 7, 8, 0, 0 };
+  long expectB[] = { 0, 0, 0, 0, 5, 0, 0, 0, 0, 10 };
+  uint8_t countA = 0;
+  uint8_t countB = 0;
+
+  for (int i = 0; i < 10; i++)
+  {
+    scale.handle_interrupt();
+    assertEqual(i + 1, scale.conversions);
+    assertEqual(expectPulses[i], scale.pulses[i]);
+
+    HX711_sample sample;
+    bool delivered = scale.read_sample(sample);
+    assertEqual(expectA[i] != 0 || expectB[i] != 0, delivered);
+    if (!delivered) continue;
+
+    if (sample.gain == 128)
+    {
+      assertEqual(expectA[i], sample.value);
+      countA++;
+    }
+    else
+    {
+      assertEqual(32, sample.gain);
+      assertEqual(expectB[i], sample.value);
+      countB++;
+    }
+  }
+  assertEqual(5, countA);
+  assertEqual(2, countB);
+  assertEqual(0, scale.available());
+  assertEqual(0, scale.overruns());
+}
+
+
+unittest(test_schedule_off)
+{
+  GodmodeState* state = GODMODE();
+  state->reset();
+
+  ScheduledHX711 scale;
+  scale.begin(dataPin, clockPin);
+  scale.set_gain(64);
+  scale.set_schedule(2, 32, 1);
+  scale.set_schedule(1, 32, 0);
+
+  // without a secondary channel every conversion is at get_gain(); only
+  // the first, still started at 128, settles
+  HX711_sample sample;
+  scale.handle_interrupt();
+  assertEqual(3, scale.pulses[0]);
+  assertTrue(scale.read_sample(sample));
+  assertEqual(128, sample.gain);
+
+  scale.handle_interrupt();
+  assertFalse(scale.read_sample(sample));
+
+  for (int i = 2; i < 6; i++)
+  {
+    scale.handle_interrupt();
+    assertEqual(3, scale.pulses[i]);
+    assertTrue(scale.read_sample(sample));
+    assertEqual(64, sample.gain);
+    assertEqual(i + 1, sample.value);
+  }
+}
+
+
+unittest(test_filters)
+{
+  HX711MovingAverage<4> average;
+  HX711Median<5> median;
+  HX711Exponential<2> exponential;
+  HX711Kalman kalman(1, 100);
+
+  assertEqual(0, average.value());
+  assertEqual(0, median.value());
+
+  long samples[] = { 100, 104, 96, 5000, 100, 102, 98, -3000, 100 };
+  for (int i = 0; i < 9; i++)
+  {
+    average.add(samples[i]);
+    median.add(samples[i]);
+    exponential.add(samples[i]);
+    kalman.add(samples[i]);
+  }
+  // last 4: 102, 98, -3000, 100
+  assertEqual(-675, average.value());
+  // last 5: 100, 102, 98, -3000, 100 -> outliers gone
+  assertEqual(100, median.value());
+
+  for (int i = 0; i < 40; i++)
+  {
+    median.add(250);
+    exponential.add(250);
+    kalman.add(250);
+  }
+  assertEqual(250, median.value());
+  assertEqual(250, exponential.value());
+  assertEqualFloat(250, kalman.value(), 5);
+
+  median.reset();
+  median.add(-7);
+  assertEqual(-7, median.value());
+}
+
+
 unittest_main()
 
 // --------
@@ -0,0 +1,347 @@
+#include "I2CBus.h"
+
+#include <util/twi.h>
+
+I2CBus I2C;
+
+ISR(TWI_vect) {
+  I2C.handleInterrupt();
+}
+
+void I2CBus::begin(uint32_t clock, uint32_t timeout) {
+  this->clock = clock;
+  this->timeout = timeout;
+
+  for (uint8_t i = 0; i < I2C_SLOT_COUNT; i++) {
+    slots[i].state = I2C_SLOT_FREE;
+  }
+  for (uint8_t p = 0; p < I2C_PRIORITIES; p++) {
+    pendingHead[p] = 0;
+    pendingCount[p] = 0;
+  }
+  active = I2C_NO_SLOT;
+  recoveryNeeded = false;
+
+  // Internal pull-ups, as Wire has them
+  digitalWrite(SDA, HIGH);
+  digitalWrite(SCL, HIGH);
+
+  TWSR = 0;
+  TWBR = ((F_CPU / clock) - 16) / 2;
+  TWCR = _BV(TWEN);
+}
+
+int8_t I2CBus::acquire(bool wait) {
+  // Every slot ahead of us finishes or times out well within this
+  unsigned long deadline = (unsigned long)timeout * 2 * (I2C_SLOT_COUNT + 1);
+  unsigned long waitingSince = micros();
+
+  do {
+    for (uint8_t i = 0; i < I2C_SLOT_COUNT; i++) {
+      if (slots[i].state == I2C_SLOT_FREE) {
+        slots[i].state = I2C_SLOT_QUEUED;
+        slots[i].retried = false;
+        return i;
+      }
+    }
+    service();
+  } while (wait && (micros() - waitingSince) < deadline);
+
+  return I2C_NO_SLOT;
+}
+
+void I2CBus::enqueue(int8_t slot, uint8_t priority) {
+  noInterrupts();
+  uint8_t tail = (
+    (pendingHead[priority] + pendingCount[priority]) % I2C_SLOT_COUNT
+  );
+  pending[priority][tail] = slot;
+  pendingCount[priority]++;
+
+  // Behind a STOP that's still going out, service() starts it instead
+  if (active == I2C_NO_SLOT && !recoveryNeeded && !(TWCR & _BV(TWSTO))) {
+    start(0);
+  }
+  interrupts();
+}
+
+int8_t I2CBus::submit(
+  uint8_t address,
+  const uint8_t* tx,
+  uint8_t txLength,
+  uint8_t rxLength,
+  uint8_t priority
+) {
+  if (txLength + rxLength > I2C_BUFFER_SIZE) {
+    lastStatus = I2C_TOO_LONG;
+    return I2C_NO_SLOT;
+  }
+
+  int8_t slot = acquire(false);
+  if (slot == I2C_NO_SLOT) {
+    return I2C_NO_SLOT;
+  }
+  slots[slot].address = address;
+  slots[slot].txLength = txLength;
+  slots[slot].rxLength = rxLength;
+  slots[slot].detached = false;
+  memcpy(slots[slot].data, tx, txLength);
+
+  enqueue(slot, priority);
+  return slot;
+}
+
+uint8_t I2CBus::collect(int8_t slot, uint8_t* rx) {
+  if (rx != NULL) {
+    memcpy(rx, slots[slot].data + slots[slot].txLength, slots[slot].rxLength);
+  }
+  uint8_t status = slots[slot].status;
+  slots[slot].state = I2C_SLOT_FREE;
+
+  return status;
+}
+
+uint8_t I2CBus::queue(
+  uint8_t address,
+  const uint8_t* data,
+  uint8_t length,
+  uint8_t priority
+) {
+  if (length > I2C_BUFFER_SIZE) {
+    return I2C_TOO_LONG;
+  }
+
+  int8_t slot = acquire(true);
+  if (slot == I2C_NO_SLOT) {
+    droppedCount++;
+    return I2C_TIMEOUT;
+  }
+  slots[slot].address = address;
+  slots[slot].txLength = length;
+  slots[slot].rxLength = 0;
+  slots[slot].detached = true;
+  memcpy(slots[slot].data, data, length);
+
+  enqueue(slot, priority);
+  return I2C_OK;
+}
+
+uint8_t I2CBus::transfer(
+  uint8_t address,
+  const uint8_t* tx,
+  uint8_t txLength,
+  uint8_t* rx,
+  uint8_t rxLength
+) {
+  if (txLength + rxLength > I2C_BUFFER_SIZE) {
+    return lastStatus = I2C_TOO_LONG;
+  }
+
+  int8_t slot = acquire(true);
+  if (slot == I2C_NO_SLOT) {
+    return lastStatus = I2C_TIMEOUT;
+  }
+  slots[slot].address = address;
+  slots[slot].txLength = txLength;
+  slots[slot].rxLength = rxLength;
+  slots[slot].detached = false;
+  memcpy(slots[slot].data, tx, txLength);
+
+  enqueue(slot, I2C_PRIORITY_HIGH);
+  while (!done(slot)) {
+    service();
+  }
+
+  return collect(slot, rx);
+}
+
+// Interrupts are off for these three
+bool I2CBus::start(uint8_t control) {
+  if (active == I2C_NO_SLOT) {
+    for (uint8_t p = 0; p < I2C_PRIORITIES; p++) {
+      if (pendingCount[p]) {
+        active = pending[p][pendingHead[p]];
+        pendingHead[p] = (pendingHead[p] + 1) % I2C_SLOT_COUNT;
+        pendingCount[p]--;
+        break;
+      }
+    }
+    if (active == I2C_NO_SLOT) {
+      return false;
+    }
+  }
+
+  slots[active].state = I2C_SLOT_ACTIVE;
+  index = 0;
+  reading = (slots[active].txLength == 0);
+  startedAt = micros();
+  TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT) | _BV(TWSTA) | control;
+
+  return true;
+}
+
+void I2CBus::finish(uint8_t status) {
+  I2CSlot& slot = slots[active];
+
+  if (status == I2C_NACK_ADDRESS || status == I2C_NACK_DATA) {
+    nackCount++;
+  }
+  if (status != I2C_OK && slot.detached) {
+    droppedCount++;
+  }
+  slot.status = status;
+  lastStatus = status;
+  slot.state = slot.detached ? I2C_SLOT_FREE : I2C_SLOT_DONE;
+  active = I2C_NO_SLOT;
+
+  // STOP, and straight into the next START if there's more to do
+  if (!start(_BV(TWSTO))) {
+    TWCR = _BV(TWEN) | _BV(TWINT) | _BV(TWSTO);
+    stoppedAt = micros();
+  }
+}
+
+void I2CBus::fail(uint8_t status) {
+  // Let go of the lines; service() recovers the bus and retries
+  TWCR = 0;
+  slots[active].status = status;
+  lastStatus = status;
+  recoveryNeeded = true;
+}
+
+void I2CBus::handleInterrupt() {
+  const uint8_t next = _BV(TWEN) | _BV(TWIE) | _BV(TWINT);
+
+  if (active == I2C_NO_SLOT) {
+    TWCR = _BV(TWEN) | _BV(TWINT);
+    return;
+  }
+  I2CSlot& slot = slots[active];
+
+  switch (TW_STATUS) {
+    case TW_START:
+    case TW_REP_START:
+      TWDR = (slot.address << 1) | (reading ? TW_READ : TW_WRITE);
+      TWCR = next;
+      break;
+    case TW_MT_SLA_ACK:
+    case TW_MT_DATA_ACK:
+      if (index < slot.txLength) {
+        TWDR = slot.data[index++];
+        TWCR = next;
+      } else if (slot.rxLength > 0) {
+        reading = true;
+        index = 0;
+        TWCR = next | _BV(TWSTA);
+      } else {
+        finish(I2C_OK);
+      }
+      break;
+    case TW_MT_SLA_NACK:
+    case TW_MR_SLA_NACK:
+      finish(I2C_NACK_ADDRESS);
+      break;
+    case TW_MT_DATA_NACK:
+      finish(I2C_NACK_DATA);
+      break;
+    case TW_MR_SLA_ACK:
+      // NACK the last byte we want
+      TWCR = next | (slot.rxLength > 1 ? _BV(TWEA) : 0);
+      break;
+    case TW_MR_DATA_ACK:
+      slot.data[slot.txLength + index++] = TWDR;
+      TWCR = next | ((index + 1) < slot.rxLength ? _BV(TWEA) : 0);
+      break;
+    case TW_MR_DATA_NACK:
+      slot.data[slot.txLength + index++] = TWDR;
+      finish(I2C_OK);
+      break;
+    default:
+      // Bus error or lost arbitration
+      fail(I2C_ERROR);
+      break;
+  }
+}
+
+void I2CBus::service() {
+  noInterrupts();
+  if (
+    active != I2C_NO_SLOT
+    && !recoveryNeeded
+    && (micros() - startedAt) > timeout
+  ) {
+    timeoutCount++;
+    fail(I2C_TIMEOUT);
+  } else if (active == I2C_NO_SLOT && !recoveryNeeded) {
+    if (!(TWCR & _BV(TWSTO))) {
+      // Whatever was queued while the last STOP went out
+      start(0);
+    } else if ((micros() - stoppedAt) > timeout) {
+      // A slave holding SCL low never lets the STOP out
+      timeoutCount++;
+      lastStatus = I2C_TIMEOUT;
+      recoveryNeeded = true;
+    }
+  }
+  bool recovering = recoveryNeeded;
+  interrupts();
+
+  if (!recovering) {
+    return;
+  }
+  recover();
+
+  noInterrupts();
+  recoveryNeeded = false;
+  if (active != I2C_NO_SLOT) {
+    I2CSlot& slot = slots[active];
+    if (!slot.retried) {
+      slot.retried = true;
+    } else {
+      if (slot.detached) {
+        droppedCount++;
+      }
+      slot.state = slot.detached ? I2C_SLOT_FREE : I2C_SLOT_DONE;
+      active = I2C_NO_SLOT;
+    }
+  }
+  start(0);
+  interrupts();
+}
+
+bool I2CBus::recover() {
+  recoveryCount++;
+
+  // Take the pins back from the TWI and drive them open-drain style:
+  // OUTPUT (LOW) pulls the line down, INPUT lets the pull-up release it.
+  TWCR = 0;
+  digitalWrite(SDA, LOW);
+  digitalWrite(SCL, LOW);
+  pinMode(SDA, INPUT);
+  pinMode(SCL, INPUT);
+
+  for (
+    uint8_t i = 0;
+    i < I2C_RECOVERY_CLOCKS && digitalRead(SDA) == LOW;
+    i++
+  ) {
+    pinMode(SCL, OUTPUT);
+    delayMicroseconds(5);
+    pinMode(SCL, INPUT);
+    delayMicroseconds(5);
+  }
+
+  // STOP: SDA rises while SCL is high
+  pinMode(SDA, OUTPUT);
+  delayMicroseconds(5);
+  pinMode(SDA, INPUT);
+  delayMicroseconds(5);
+
+  bool idle = (digitalRead(SDA) == HIGH && digitalRead(SCL) == HIGH);
+
+  digitalWrite(SDA, HIGH);
+  digitalWrite(SCL, HIGH);
+  TWCR = _BV(TWEN);
+
+  return idle;
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Transaction status; 0-5 match what Wire's endTransmission() returns
+#define I2C_OK 0
+#define I2C_TOO_LONG 1
+#define I2C_NACK_ADDRESS 2
+#define I2C_NACK_DATA 3
+#define I2C_ERROR 4
+#define I2C_TIMEOUT 5
+
+// Expander reads go ahead of display writes; order within a priority is kept
+#define I2C_PRIORITY_HIGH 0
+#define I2C_PRIORITY_LOW 1
+#define I2C_PRIORITIES 2
+
+// Bytes written plus bytes read by any one transaction
+#define I2C_BUFFER_SIZE 32
+#define I2C_SLOT_COUNT 6
+#define I2C_NO_SLOT -1
+
+#define I2C_SLOT_FREE 0
+#define I2C_SLOT_QUEUED 1
+#define I2C_SLOT_ACTIVE 2
+#define I2C_SLOT_DONE 3
+
+#define I2C_DEFAULT_CLOCK 400000
+// Longest any single transaction may hold the bus, in microseconds
+#define I2C_DEFAULT_TIMEOUT 3000
+// SCL pulses needed to walk a slave out of any byte it is stuck in
+#define I2C_RECOVERY_CLOCKS 9
+
+struct I2CSlot {
+  volatile uint8_t state;
+  volatile uint8_t status;
+  uint8_t address;
+  uint8_t txLength;
+  uint8_t rxLength;
+  // Freed by the engine once sent; nobody collects the result
+  bool detached;
+  bool retried;
+  // Written bytes, followed by the bytes read
+  uint8_t data[I2C_BUFFER_SIZE];
+};
+
+// Every transfer on the bus goes through here. Transactions are queued in
+// a small pool of slots and run from the TWI interrupt, so loop() never
+// waits on the bus; a stuck or noisy bus costs a recovery instead of
+// blocking until the watchdog resets the controller.
+class I2CBus {
+public:
+  void begin(
+    uint32_t clock = I2C_DEFAULT_CLOCK,
+    uint32_t timeout = I2C_DEFAULT_TIMEOUT
+  );
+
+  // Queues a transaction writing txLength bytes, then reading rxLength
+  // bytes if rxLength isn't 0. Returns the slot to check with done() and
+  // collect(), or I2C_NO_SLOT if every slot is taken.
+  int8_t submit(
+    uint8_t address,
+    const uint8_t* tx,
+    uint8_t txLength,
+    uint8_t rxLength = 0,
+    uint8_t priority = I2C_PRIORITY_HIGH
+  );
+  bool done(int8_t slot) {
+    return slots[slot].state == I2C_SLOT_DONE;
+  }
+  // Copies out what was read, frees the slot and returns its status
+  uint8_t collect(int8_t slot, uint8_t* rx = NULL);
+
+  // Queues a write nobody waits on, waiting only for a free slot
+  uint8_t queue(
+    uint8_t address,
+    const uint8_t* data,
+    uint8_t length,
+    uint8_t priority = I2C_PRIORITY_LOW
+  );
+  // Queues a transaction and waits for it. A timeout or bus error
+  // recovers the bus and retries once.
+  uint8_t transfer(
+    uint8_t address,
+    const uint8_t* tx,
+    uint8_t txLength,
+    uint8_t* rx = NULL,
+    uint8_t rxLength = 0
+  );
+
+  // Call often: times out a transaction the bus has stopped answering,
+  // and runs the recovery the interrupt handler can't.
+  void service();
+  // Clocks SCL until the slave holding SDA low lets go, then issues a STOP.
+  // Returns whether the bus is idle afterwards.
+  bool recover();
+
+  // ISR context
+  void handleInterrupt();
+
+  // Nothing queued or in flight, so the TWI can be stopped. Only a check:
+  // a STOP that never goes out is recovered by service().
+  bool idle() {
+    for (uint8_t p = 0; p < I2C_PRIORITIES; p++) {
+      if (pendingCount[p] > 0) {
+        return false;
+      }
+    }
+    // ...including the last STOP
+    return (
+      (active == I2C_NO_SLOT)
+      && !recoveryNeeded
+      && !(TWCR & _BV(TWSTO))
+    );
+  }
+
+  uint8_t status() { return lastStatus; }
+  uint16_t nacks() { return nackCount; }
+  uint16_t timeouts() { return timeoutCount; }
+  uint16_t recoveries() { return recoveryCount; }
+  // Writes from queue() that never went out whole
+  uint16_t dropped() { return droppedCount; }
+
+private:
+  int8_t acquire(bool wait);
+  void enqueue(int8_t slot, uint8_t priority);
+  bool start(uint8_t control);
+  void finish(uint8_t status);
+  void fail(uint8_t status);
+
+  I2CSlot slots[I2C_SLOT_COUNT];
+  // One FIFO of slot numbers per priority
+  volatile int8_t pending[I2C_PRIORITIES][I2C_SLOT_COUNT];
+  volatile uint8_t pendingHead[I2C_PRIORITIES];
+  volatile uint8_t pendingCount[I2C_PRIORITIES];
+
+  volatile int8_t active = I2C_NO_SLOT;
+  volatile uint8_t index = 0;
+  volatile bool reading = false;
+  volatile bool recoveryNeeded = false;
+  volatile unsigned long startedAt = 0;
+  volatile unsigned long stoppedAt = 0;
+
+  uint32_t clock = I2C_DEFAULT_CLOCK;
+  uint32_t timeout = I2C_DEFAULT_TIMEOUT;
+  volatile uint8_t lastStatus = I2C_OK;
+  volatile uint16_t nackCount = 0;
+  volatile uint16_t timeoutCount = 0;
+  uint16_t recoveryCount = 0;
+  volatile uint16_t droppedCount = 0;
+};
+
+extern I2CBus I2C;
@@ -0,0 +1,37 @@
+#include "U8g2I2CBus.h"
+
+uint8_t u8x8_byte_i2cbus(
+  u8x8_t* u8x8,
+  uint8_t msg,
+  uint8_t arg_int,
+  void* arg_ptr
+) {
+  static uint8_t buffer[I2C_BUFFER_SIZE];
+  static uint8_t length;
+
+  switch (msg) {
+    case U8X8_MSG_BYTE_SEND: {
+      // U8g2 keeps its I2C transfers well under the buffer size
+      const uint8_t* data = (const uint8_t*)arg_ptr;
+      while (arg_int-- > 0 && length < I2C_BUFFER_SIZE) {
+        buffer[length++] = *data++;
+      }
+      break;
+    }
+    case U8X8_MSG_BYTE_INIT:
+      // The bus is shared, and begun by its owner
+      break;
+    case U8X8_MSG_BYTE_SET_DC:
+      break;
+    case U8X8_MSG_BYTE_START_TRANSFER:
+      length = 0;
+      break;
+    case U8X8_MSG_BYTE_END_TRANSFER:
+      // Drawing carries on while this goes out
+      I2C.queue(u8x8_GetI2CAddress(u8x8) >> 1, buffer, length);
+      break;
+    default:
+      return 0;
+  }
+  return 1;
+}
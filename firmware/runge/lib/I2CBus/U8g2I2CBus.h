@@ -0,0 +1,25 @@
+#pragma once
+
+#include <U8g2lib.h>
+#include "I2CBus.h"
+
+// U8x8 byte procedure sending the display's transfers through I2C
+uint8_t u8x8_byte_i2cbus(
+  u8x8_t* u8x8,
+  uint8_t msg,
+  uint8_t arg_int,
+  void* arg_ptr
+);
+
+// Same display as U8G2_SSD1306_128X32_UNIVISION_1_HW_I2C, on I2CBus
+class U8G2_SSD1306_128X32_UNIVISION_1_I2CBUS : public U8G2 {
+public:
+  U8G2_SSD1306_128X32_UNIVISION_1_I2CBUS(const u8g2_cb_t* rotation) : U8G2() {
+    u8g2_Setup_ssd1306_i2c_128x32_univision_1(
+      &u8g2,
+      rotation,
+      u8x8_byte_i2cbus,
+      u8x8_gpio_and_delay_arduino
+    );
+  }
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Bucket 0 holds passes under 64us, each one after that twice as wide,
+// and the last everything from there up.
+#define LOOP_PROFILE_FIRST_SHIFT 6
+
+// Keeps a log2 histogram of how long loop() passes take, per group of
+// states, in a handful of bytes each. Call mark() once at the top of
+// every pass; the pass before it is counted against the group that was
+// current then.
+template <uint8_t Groups, uint8_t Buckets = 10>
+class LoopProfile {
+public:
+  LoopProfile() {
+    reset();
+  }
+
+  void reset() {
+    memset(histogram, 0, sizeof(histogram));
+    memset(longest, 0, sizeof(longest));
+    memset(passes, 0, sizeof(passes));
+    skip();
+  }
+
+  // Doesn't count the pass in progress, e.g. one that printed a dump
+  void skip() {
+    started = false;
+  }
+
+  void mark(uint8_t group) {
+    unsigned long now = micros();
+
+    if (started) {
+      record(lastGroup, now - lastMark);
+    }
+    started = true;
+    lastMark = now;
+    lastGroup = group;
+  }
+
+  void dump(Print& out, const char* const names[]) {
+    for (uint8_t group = 0; group < Groups; group++) {
+      out.print(names[group]);
+      out.print(": passes ");
+      out.print(passes[group]);
+      out.print(", max (us) ");
+      out.println(longest[group]);
+      for (uint8_t i = 0; i < Buckets; i++) {
+        if (histogram[group][i] == 0) {
+          continue;
+        }
+        out.print("  ");
+        out.print(i == 0 ? 0UL : (1UL << (i + LOOP_PROFILE_FIRST_SHIFT - 1)));
+        out.print((i == Buckets - 1) ? "+" : "-");
+        if (i < Buckets - 1) {
+          out.print((1UL << (i + LOOP_PROFILE_FIRST_SHIFT)) - 1);
+        }
+        out.print(": ");
+        out.println(histogram[group][i]);
+      }
+    }
+  }
+
+private:
+  void record(uint8_t group, unsigned long duration) {
+    uint8_t bucket = 0;
+    unsigned long limit = 1UL << LOOP_PROFILE_FIRST_SHIFT;
+    while ((duration >= limit) && (bucket < Buckets - 1)) {
+      bucket++;
+      limit <<= 1;
+    }
+
+    // Halving the whole group when a bucket fills keeps its shape
+    if (histogram[group][bucket] == 255) {
+      for (uint8_t i = 0; i < Buckets; i++) {
+        histogram[group][i] >>= 1;
+      }
+    }
+    histogram[group][bucket]++;
+
+    if (duration > longest[group]) {
+      longest[group] = min(duration, 0xFFFFUL);
+    }
+    if (passes[group] < 0xFFFF) {
+      passes[group]++;
+    }
+  }
+
+  uint8_t histogram[Groups][Buckets];
+  uint16_t longest[Groups];
+  uint16_t passes[Groups];
+  bool started;
+  uint8_t lastGroup;
+  unsigned long lastMark;
+};
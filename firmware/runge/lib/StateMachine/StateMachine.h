@@ -0,0 +1,99 @@
+#pragma once
+
+#include <Arduino.h>
+
+// In a transition table: the state ignores this event
+#define STATE_MACHINE_IGNORE 0xFF
+
+// Gets the clock's time when called; any of a state's handlers may be NULL
+typedef void (*StateHandler)(unsigned long now);
+
+struct StateDef {
+  StateHandler enter;
+  StateHandler tick;
+  StateHandler exit;
+};
+
+// Runs a controller off two tables kept in flash: each state's handlers,
+// and which state each event leads to from each state. Dispatching an
+// event is one table lookup however many states there are, and time only
+// comes from the clock it's given, so it can run off millis() on the
+// board or a fake clock on a host.
+template <uint8_t States, uint8_t Events>
+class StateMachine {
+public:
+  typedef unsigned long (*Clock)();
+  // Called between leaving one state and entering the next
+  typedef void (*Listener)(uint8_t from, uint8_t to);
+
+  StateMachine(
+    const StateDef (&states)[States],
+    const uint8_t (&transitions)[States][Events],
+    Clock clock,
+    Listener listener = NULL
+  ) :
+    states(states),
+    transitions(transitions),
+    clock(clock),
+    listener(listener)
+  {}
+
+  void begin(uint8_t initial) {
+    state = initial;
+    enteredAt = clock();
+    run(&states[state].enter, enteredAt);
+  }
+
+  uint8_t current() const {
+    return state;
+  }
+  // How long we've been in the current state
+  unsigned long elapsed() const {
+    return clock() - enteredAt;
+  }
+
+  // Follows event's transition out of the current state, if it has one
+  bool dispatch(uint8_t event) {
+    uint8_t next = pgm_read_byte(&transitions[state][event]);
+    if (next == STATE_MACHINE_IGNORE) {
+      return false;
+    }
+    go(next);
+    return true;
+  }
+
+  // Goes straight to next; going to the current state leaves and enters it
+  void go(uint8_t next) {
+    unsigned long now = clock();
+    uint8_t previous = state;
+
+    run(&states[previous].exit, now);
+    state = next;
+    enteredAt = now;
+    if (listener != NULL) {
+      listener(previous, next);
+    }
+    run(&states[next].enter, now);
+  }
+
+  // Call once per pass
+  void tick() {
+    run(&states[state].tick, clock());
+  }
+
+private:
+  static void run(const StateHandler* handler, unsigned long now) {
+    StateHandler function = (StateHandler)pgm_read_ptr(handler);
+    if (function != NULL) {
+      function(now);
+    }
+  }
+
+  const StateDef* states;
+  const uint8_t (*transitions)[Events];
+  Clock clock;
+  Listener listener;
+
+  uint8_t state = 0;
+  unsigned long enteredAt = 0;
+};
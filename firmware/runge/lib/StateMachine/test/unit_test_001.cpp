@@ -0,0 +1,183 @@
+//
+//    FILE: unit_test_001.cpp
+// PURPOSE: unit tests for the StateMachine library
+//          https://github.com/Arduino-CI/arduino_ci/blob/master/REFERENCE.md
+//
+
+#include <ArduinoUnitTests.h>
+
+
+#include "Arduino.h"
+#include "StateMachine.h"
+
+#define TEST_IDLE 0
+#define TEST_RUN 1
+#define TEST_DONE 2
+#define TEST_STATES 3
+
+#define TEST_GO 0
+#define TEST_STOP 1
+#define TEST_RESET 2
+#define TEST_EVENTS 3
+
+unsigned long fakeNow = 0;
+
+unsigned long fakeClock()
+{
+  return fakeNow;
+}
+
+// one letter per handler call: E/T/X enter, tick and leave TEST_RUN,
+// t ticks TEST_IDLE
+char trace[32];
+uint8_t traceLength = 0;
+unsigned long enteredAt = 0;
+
+void note(char c)
+{
+  if (traceLength < sizeof(trace) - 1)
+  {
+    trace[traceLength++] = c;
+    trace[traceLength] = '\0';
+  }
+}
+
+void enterRun(unsigned long now) { note('E'); enteredAt = now; }
+void tickRun(unsigned long now)  { note('T'); }
+void exitRun(unsigned long now)  { note('X'); }
+void tickIdle(unsigned long now) { note('t'); }
+
+uint8_t changedFrom = 0xFF;
+uint8_t changedTo = 0xFF;
+uint8_t changes = 0;
+
+void changed(uint8_t from, uint8_t to)
+{
+  changedFrom = from;
+  changedTo = to;
+  changes++;
+}
+
+const StateDef testStates[TEST_STATES] PROGMEM = {
+  { NULL, tickIdle, NULL },
+  { enterRun, tickRun, exitRun },
+  { NULL, NULL, NULL },
+};
+
+#define STAY STATE_MACHINE_IGNORE
+const uint8_t testTransitions[TEST_STATES][TEST_EVENTS] PROGMEM = {
+  // go, stop, reset
+  { TEST_RUN, STAY, STAY },
+  { STAY, TEST_DONE, TEST_IDLE },
+  { STAY, STAY, TEST_IDLE },
+};
+#undef STAY
+
+
+unittest_setup()
+{
+  fakeNow = 0;
+  trace[0] = '\0';
+  traceLength = 0;
+  enteredAt = 0;
+  changedFrom = 0xFF;
+  changedTo = 0xFF;
+  changes = 0;
+}
+
+unittest_teardown()
+{
+}
+
+
+unittest(test_begin)
+{
+  StateMachine<TEST_STATES, TEST_EVENTS> machine(
+    testStates, testTransitions, fakeClock, changed
+  );
+
+  fakeNow = 500;
+  machine.begin(TEST_RUN);
+  assertEqual(TEST_RUN, machine.current());
+  assertEqual(0, strcmp("E", trace));
+  assertEqual(500, enteredAt);
+  // starting isn't a change
+  assertEqual(0, changes);
+}
+
+
+unittest(test_transitions)
+{
+  StateMachine<TEST_STATES, TEST_EVENTS> machine(
+    testStates, testTransitions, fakeClock, changed
+  );
+  machine.begin(TEST_IDLE);
+
+  machine.tick();
+  assertEqual(0, strcmp("t", trace));
+
+  fakeNow = 100;
+  assertTrue(machine.dispatch(TEST_GO));
+  assertEqual(TEST_RUN, machine.current());
+  assertEqual(100, enteredAt);
+  assertEqual(TEST_IDLE, changedFrom);
+  assertEqual(TEST_RUN, changedTo);
+
+  fakeNow = 350;
+  assertEqual(250, machine.elapsed());
+  machine.tick();
+
+  assertTrue(machine.dispatch(TEST_STOP));
+  assertEqual(TEST_DONE, machine.current());
+  assertEqual(0, machine.elapsed());
+  // a state without handlers ticks quietly
+  machine.tick();
+
+  assertTrue(machine.dispatch(TEST_RESET));
+  assertEqual(TEST_IDLE, machine.current());
+  assertEqual(3, changes);
+  assertEqual(0, strcmp("tETX", trace));
+}
+
+
+unittest(test_ignored_events)
+{
+  StateMachine<TEST_STATES, TEST_EVENTS> machine(
+    testStates, testTransitions, fakeClock, changed
+  );
+  machine.begin(TEST_IDLE);
+
+  fakeNow = 100;
+  assertFalse(machine.dispatch(TEST_STOP));
+  assertFalse(machine.dispatch(TEST_RESET));
+  assertEqual(TEST_IDLE, machine.current());
+  // time in the state keeps running
+  assertEqual(100, machine.elapsed());
+  assertEqual(0, changes);
+
+  machine.go(TEST_RUN);
+  assertFalse(machine.dispatch(TEST_GO));
+  assertEqual(TEST_RUN, machine.current());
+  assertEqual(0, strcmp("E", trace));
+}
+
+
+unittest(test_reenter)
+{
+  StateMachine<TEST_STATES, TEST_EVENTS> machine(
+    testStates, testTransitions, fakeClock
+  );
+  machine.begin(TEST_RUN);
+
+  // going to the current state leaves it and comes back in
+  fakeNow = 42;
+  machine.go(TEST_RUN);
+  assertEqual(TEST_RUN, machine.current());
+  assertEqual(0, strcmp("EXE", trace));
+  assertEqual(42, enteredAt);
+}
+
+
+unittest_main()
+
+// --------
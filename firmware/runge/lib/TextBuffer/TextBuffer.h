@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// Fixed-capacity text that lives wherever it's declared, so building a
+// message never touches the heap. Anything past Capacity is dropped.
+template <uint8_t Capacity>
+class TextBuffer {
+public:
+  TextBuffer() {
+    clear();
+  }
+  TextBuffer(const char* value) {
+    clear();
+    append(value);
+  }
+
+  TextBuffer& clear() {
+    used = 0;
+    text[0] = '\0';
+    return *this;
+  }
+
+  TextBuffer& append(char c) {
+    if (used < Capacity) {
+      text[used++] = c;
+      text[used] = '\0';
+    }
+    return *this;
+  }
+
+  TextBuffer& append(const char* value) {
+    while (*value != '\0' && used < Capacity) {
+      text[used++] = *value++;
+    }
+    text[used] = '\0';
+    return *this;
+  }
+
+  TextBuffer& append(long value) {
+    if (value < 0) {
+      append('-');
+      return appendDigits(-(unsigned long)value);
+    }
+    return appendDigits(value);
+  }
+  TextBuffer& append(int value) {
+    return append((long)value);
+  }
+  TextBuffer& append(unsigned long value) {
+    return appendDigits(value);
+  }
+  TextBuffer& append(unsigned int value) {
+    return appendDigits(value);
+  }
+  TextBuffer& append(uint8_t value) {
+    return appendDigits(value);
+  }
+
+  // A value in tenths, e.g. 123 as "12.3"
+  TextBuffer& appendTenths(long tenths) {
+    if (tenths < 0) {
+      append('-');
+      tenths = -tenths;
+    }
+    appendDigits(tenths / 10);
+    append('.');
+    return append((char)('0' + tenths % 10));
+  }
+
+  TextBuffer& operator=(const char* value) {
+    return clear().append(value);
+  }
+
+  bool operator==(const TextBuffer& other) const {
+    return used == other.used && memcmp(text, other.text, used) == 0;
+  }
+  bool operator!=(const TextBuffer& other) const {
+    return !(*this == other);
+  }
+
+  const char* c_str() const {
+    return text;
+  }
+  uint8_t length() const {
+    return used;
+  }
+
+private:
+  TextBuffer& appendDigits(unsigned long value) {
+    // Digits come out backwards; 10 is enough for any 32-bit value
+    char digits[10];
+    uint8_t count = 0;
+    do {
+      digits[count++] = '0' + value % 10;
+      value /= 10;
+    } while (value > 0);
+
+    while (count > 0) {
+      append(digits[--count]);
+    }
+    return *this;
+  }
+
+  uint8_t used;
+  char text[Capacity + 1];
+};
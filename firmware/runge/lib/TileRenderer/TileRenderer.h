@@ -0,0 +1,108 @@
+#pragma once
+
+#include <U8g2lib.h>
+#include <util/crc16.h>
+
+// Renders a page-buffered U8g2 display one tile row at a time, and sends
+// only the 8x8 tiles whose contents changed since the last frame. Each
+// tile is remembered by a 16-bit CRC rather than its pixels, so the whole
+// 128x32 screen costs 128 bytes of RAM instead of 512.
+//
+// The display must use a one tile row page buffer (the "_1_" U8g2
+// constructors), whose bytes are laid out exactly as SSD1306 tiles.
+template <uint8_t TileColumns, uint8_t TileRows>
+class TileRenderer {
+public:
+  typedef void (*DrawFunction)(U8G2& display);
+
+  TileRenderer(U8G2& display) : display(display) {}
+
+  // The next frame sends every tile; after begin() or a power save,
+  // the controller's RAM can't be trusted. Nor can it after a write that
+  // was lost, since the hashes only say what was sent, or after long
+  // enough that two different tiles may have shared a hash.
+  void invalidate() {
+    forceAll = true;
+  }
+
+  // A frame can also be drawn a tile row at a time, so that no single
+  // call holds things up for a whole frame: startFrame(), then step()
+  // while rendering(). The draw function is called once per row and
+  // must draw the same frame each time.
+  void startFrame() {
+    nextRow = 0;
+    frameForced = forceAll;
+    forceAll = false;
+  }
+  bool rendering() {
+    return nextRow < TileRows;
+  }
+  // Returns how many tiles were sent
+  uint8_t step(DrawFunction draw) {
+    return renderRow(nextRow++, draw);
+  }
+
+  // Draws a whole frame; returns how many tiles were sent
+  uint8_t render(DrawFunction draw) {
+    uint8_t sent = 0;
+    startFrame();
+    while (rendering()) {
+      sent += step(draw);
+    }
+    return sent;
+  }
+
+private:
+  // Draws one tile row of the frame and sends the tiles that changed
+  uint8_t renderRow(uint8_t row, DrawFunction draw) {
+    display.setBufferCurrTileRow(row);
+    display.clearBuffer();
+    draw(display);
+
+    uint8_t* buffer = display.getBufferPtr();
+    uint8_t sent = 0;
+    uint8_t runStart = 0;
+    uint8_t runLength = 0;
+    for (uint8_t column = 0; column < TileColumns; column++) {
+      uint8_t* tile = buffer + column * 8;
+      uint16_t hash = 0xFFFF;
+      for (uint8_t i = 0; i < 8; i++) {
+        hash = _crc16_update(hash, tile[i]);
+      }
+
+      if (frameForced || hash != hashes[row][column]) {
+        hashes[row][column] = hash;
+        if (runLength == 0) {
+          runStart = column;
+        }
+        runLength++;
+      } else if (runLength > 0) {
+        sendRun(row, runStart, runLength);
+        sent += runLength;
+        runLength = 0;
+      }
+    }
+    if (runLength > 0) {
+      sendRun(row, runStart, runLength);
+      sent += runLength;
+    }
+
+    return sent;
+  }
+
+  void sendRun(uint8_t row, uint8_t column, uint8_t length) {
+    u8x8_DrawTile(
+      display.getU8x8(),
+      column,
+      row,
+      length,
+      display.getBufferPtr() + column * 8
+    );
+  }
+
+  U8G2& display;
+  bool forceAll = true;
+  bool frameForced = false;
+  uint8_t nextRow = TileRows;
+  uint16_t hashes[TileRows][TileColumns];
+};
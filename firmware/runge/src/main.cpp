@@ -1,11 +1,23 @@
 #include <Arduino.h>
 #include <U8g2lib.h>
+#include <I2CBus.h>
+#include <U8g2I2CBus.h>
+#include <TileRenderer.h>
+#include <TextBuffer.h>
+#include <StateMachine.h>
+#ifdef LOOP_PROFILE
+#include <LoopProfile.h>
+#endif
 #include <Adafruit_MCP23017.h>
 #include <Rotary.h>
 #include <Bounce2mcp.h>
 #include <avr/wdt.h>
+#include <avr/sleep.h>
 #include <Atmega328Pins.h>
 #include <EEPROM.h>
+#include <util/crc16.h>
+#include <HX711Fast.h>
+#include <HX711Filter.h>
 
 #define INTERFACE_ROTARY_SIG 8
 #define INTERFACE_ROTARY_GND 9
@@ -14,8 +26,15 @@
 #define INTERFACE_BUTTON_SIG 11
 #define INTERFACE_BUTTON_GND 12
 
+// The expander's (mirrored) INT output
+#define INTERFACE_INT PIN_PC3
+#define INTERFACE_HEALTH_INTERVAL 500
+
 #define GRINDER_SIG PIN_PB0
 
+#define SCALE_DATA PIN_PD5
+#define SCALE_CLOCK PIN_PD6
+
 #define PORTAFILTER_WEIGHT 171
 
 #define STATE_SLEEP 0
@@ -23,38 +42,340 @@
 #define STATE_GRINDING 2
 #define STATE_DONE 3
 #define STATE_LOCKOUT 4
+#define STATE_WEIGHT 5
+#define STATE_GRINDING_WEIGHT 6
+#define STATE_CALIBRATE_ZERO 7
+#define STATE_CALIBRATE_MASS 8
+#define STATE_CALIBRATE_CONFIRM 9
+#define STATE_COUNT 10
+
+// What moves the controller between states; see controllerTransitions
+#define EVENT_PRESS 0
+#define EVENT_LONG_PRESS 1
+#define EVENT_IDLE 2
+#define EVENT_FAULT 3
+#define EVENT_FINISHED 4
+#define EVENT_TIME_MODE 5
+#define EVENT_WEIGHT_MODE 6
+#define EVENT_COUNT 7
 
 #define MESSAGE_INTERVAL 250
+// Every tile is sent again this often, in case one was lost unnoticed
+#define DISPLAY_REFRESH_INTERVAL 10000
+#define MESSAGE_LENGTH 20
 #define GRINDER_SAFETY_LOCKOUT 30000
+// The watchdog's longest interrupt period; 16ms << 9
+#define SLEEP_LONGEST_PRESCALE 9
+// How long, in us, to wait for the bus to empty before giving up on a sleep
+#define SLEEP_DRAIN_TIMEOUT 20000
+// Timed doses are cut by Timer1 at 8us per tick (F_CPU / 64)
+#define SHUTOFF_TICKS_PER_MS (F_CPU / 64 / 1000)
+#define LONG_PRESS_INTERVAL 1000
 
-#define DEFAULT_SECONDS 10
+// Timed doses, in ms
+#define DEFAULT_DOSE_MS 10000
+#define DOSE_STEP_MS 100
+#define DOSE_MIN_MS 1000
+#define DOSE_MAX_MS 20000
+#define DEFAULT_DECIGRAMS 180
 
+// Whole seconds, from before doses were kept in ms; read once to migrate
 #define SAVED_SECONDS_LOCATION 20
+#define SAVED_MODE_LOCATION 21
+#define SAVED_DECIGRAMS_LOCATION 22
+#define SAVED_DOSE_MS_LOCATION 24
+#define CALIBRATION_LOCATION 32
+
+#define CALIBRATION_VERSION 1
+#define CALIBRATION_SAMPLES 16
+#define DEFAULT_CALIBRATION_GRAMS 100
+
+// 5kg load cell until calibrated; milligrams per count as Q12.20
+#define SCALE_MG_PER_COUNT 2496025L
+// While idle, an empty platform within ~0.5g of zero and steady
+// to ~0.2g is used to follow the load cell's temperature drift.
+#define SCALE_ZERO_BAND 210
+#define SCALE_ZERO_NOISE 85
+// Median filter length; a dose only starts from a filter this full of
+// samples taken since the scale last powered up
+#define SCALE_FILTER_SAMPLES 5
+
+// Grind-by-weight shutoff: how long grounds keep landing after the
+// motor is cut, and how far a sample trails the real weight.
+#define GRINDER_COAST 300
+#define SCALE_LATENCY 100
+#define FLOW_SAMPLES 6
+#define DOSE_SETTLE_INTERVAL 1500
+#define OVERSHOOT_LIMIT 2000
+
+// Weight graph shown right of the text while grinding; one column per
+// GRAPH_INTERVAL, swept left to right so only the newest column's tiles
+// change from frame to frame.
+#define GRAPH_WIDTH 40
+#define GRAPH_HEIGHT 32
+#define GRAPH_X (128 - GRAPH_WIDTH)
+#define GRAPH_INTERVAL 250
+// Full scale for timed grinds, which have no target weight
+#define GRAPH_DEFAULT_MG 20000L
 
 const char version[] = "v2021-05-22";
 
 Adafruit_MCP23017 interface;
-U8G2_SSD1306_128X32_UNIVISION_1_HW_I2C displayCtl(U8G2_R0);
+// Knob and button inputs are pulled up and raise INT on any change, so the
+// expander needn't be read at all while nobody is touching them; their
+// grounds are driven low.
+#define INTERFACE_INPUTS ( \
+  MCP23017_BIT(INTERFACE_ROTARY_SIG) \
+  | MCP23017_BIT(INTERFACE_ROTARY_SIG_DIR) \
+  | MCP23017_BIT(INTERFACE_BUTTON_SIG) \
+)
+#define INTERFACE_GROUNDS ( \
+  MCP23017_BIT(INTERFACE_ROTARY_GND) \
+  | MCP23017_BIT(INTERFACE_BUTTON_GND) \
+)
+const MCP23017_Config interfaceConfig = {
+  (uint16_t)~INTERFACE_GROUNDS,  // iodir
+  0,                             // ipol
+  INTERFACE_INPUTS,              // gpinten
+  0,                             // defval
+  0,                             // intcon
+  MCP23017_IOCON_MIRROR,         // iocon: one INT, active low, push-pull
+  INTERFACE_INPUTS,              // gppu
+  0,                             // olat
+};
+U8G2_SSD1306_128X32_UNIVISION_1_I2CBUS displayCtl(U8G2_R0);
+TileRenderer<16, 4> renderer(displayCtl);
 Rotary rotary;
 BounceMcp button;
+HX711Fast<SCALE_DATA, SCALE_CLOCK> scale;
+HX711Median<SCALE_FILTER_SAMPLES> scaleFilter;
 
-uint8_t state = 0;
-uint8_t secondsSelected = 0;
+uint16_t doseMsSelected = 0;
+uint16_t decigramsSelected = 0;
 
 unsigned long resetAfterTimeout = (60UL * 60UL * 20UL) * 1000UL;
 
-unsigned long grinderTimeout = 0;
 unsigned long sleepTimeout = 0;
-unsigned long grinderStart = 0;
+
+// Scale and display are powered down while we sleep
+bool lowPower = false;
+volatile bool watchdogWoke = false;
+// Kept by the Arduino core; stopped while powered down
+extern volatile unsigned long timer0_millis;
+
+// A 16-bit period is only 524ms, so the compare match also has to count
+// off the whole laps ahead of the final one.
+volatile uint8_t shutoffLaps = 0;
+volatile bool shutoffFired = false;
+volatile unsigned long shutoffAt = 0;
+unsigned long shutoffDeadline = 0;
+// How far the cut-off lands from its deadline, in us, across doses
+long shutoffErrorMin = 0;
+long shutoffErrorMax = 0;
+uint16_t shutoffCount = 0;
 
 bool rotateLeft = false;
 bool rotateRight = false;
+// A press goes down as buttonFell, then comes out as exactly one of
+// buttonPressed (let go before LONG_PRESS_INTERVAL) or buttonLongPress.
 bool buttonFell = false;
-String lastMessageDisplay = "";
-String messageDisplay = "";
+bool buttonPressed = false;
+bool buttonLongPress = false;
+// Whatever the button is doing now has already been acted on
+bool pressHandled = true;
+
+volatile bool interfaceChanged = true;
+uint16_t interfaceStatus = 0xFFFF;
+unsigned long interfaceCheckedAt = 0;
+// lastMessageDisplay is also what the frame being rendered draws
+TextBuffer<MESSAGE_LENGTH> lastMessageDisplay;
+TextBuffer<MESSAGE_LENGTH> messageDisplay;
+bool displayForced = false;
+unsigned long frameStartedAt = 0;
+unsigned long displayRefreshedAt = 0;
+// Bus failures as of the last full frame
+uint16_t displayDropped = 0;
+uint16_t displayRecoveries = 0;
 
 volatile uint16_t messageCount = 0;
 
+uint8_t scaleStatus = HX711_IDLE;
+
+struct FlowSample {
+  unsigned long time;
+  long mg;
+};
+FlowSample flowSamples[FLOW_SAMPLES];
+uint8_t flowCount = 0;
+uint8_t flowIndex = 0;
+
+long grindStartMg = 0;
+long doseTargetMg = 0;
+long doseMg = -1;
+long overshootMg = 0;
+bool doseSettling = false;
+
+uint8_t graphColumns[GRAPH_WIDTH];
+uint8_t graphCursor = 0;
+unsigned long graphSampledAt = 0;
+long graphFullScaleMg = GRAPH_DEFAULT_MG;
+bool graphChanged = false;
+bool frameShowsGraph = false;
+
+struct Calibration {
+  uint8_t version;
+  int32_t offset;
+  int32_t mgPerCount;
+  uint16_t crc;
+};
+
+uint16_t calibrationGrams = DEFAULT_CALIBRATION_GRAMS;
+uint8_t calibrationCount = 0;
+int32_t calibrationSum = 0;
+bool calibrationPending = false;
+
+uint8_t scaleFreshSamples = 0;
+// A weight dose waiting on scaleFreshSamples
+bool weightStartPending = false;
+
+// The handlers and transitions are further down, next to loop()
+void reportState(uint8_t from, uint8_t to);
+extern const StateDef controllerStates[STATE_COUNT] PROGMEM;
+extern const uint8_t controllerTransitions[STATE_COUNT][EVENT_COUNT] PROGMEM;
+StateMachine<STATE_COUNT, EVENT_COUNT> controller(
+  controllerStates,
+  controllerTransitions,
+  millis,
+  reportState
+);
+
+ISR(PCINT2_vect) {
+  scale.handle_interrupt();
+}
+
+ISR(PCINT1_vect) {
+  interfaceChanged = true;
+}
+
+#ifdef LOOP_PROFILE
+// Loop pass timings, dumped by sending 'h' over serial
+#define PROFILE_SLEEP 0
+#define PROFILE_SELECT 1
+#define PROFILE_GRINDING 2
+#define PROFILE_DONE 3
+#define PROFILE_LOCKOUT 4
+const char* const profileNames[] = {
+  "Sleep", "Select", "Grinding", "Done", "Lockout"
+};
+LoopProfile<5> loopProfile;
+
+uint8_t profileGroup(uint8_t state) {
+  switch (state) {
+    case STATE_SLEEP:
+      return PROFILE_SLEEP;
+    case STATE_GRINDING:
+    case STATE_GRINDING_WEIGHT:
+      return PROFILE_GRINDING;
+    case STATE_DONE:
+      return PROFILE_DONE;
+    case STATE_LOCKOUT:
+      return PROFILE_LOCKOUT;
+    default:
+      // Time and weight selection, and calibration
+      return PROFILE_SELECT;
+  }
+}
+
+void handleProfile() {
+  loopProfile.mark(profileGroup(controller.current()));
+
+  if (Serial.available() && (Serial.read() == 'h')) {
+    loopProfile.dump(Serial, profileNames);
+    // Printing at 9600 baud would swamp this pass's figure
+    loopProfile.skip();
+  }
+}
+#endif
+
+ISR(WDT_vect) {
+  watchdogWoke = true;
+}
+
+ISR(TIMER1_COMPA_vect) {
+  if (shutoffLaps > 0) {
+    shutoffLaps--;
+    return;
+  }
+
+  // Grinder off (active low), then stop the timer
+  ATMEGA328_PIN_PORT(GRINDER_SIG) |= _BV(ATMEGA328_PIN_BIT(GRINDER_SIG));
+  TCCR1B = 0;
+  TIMSK1 &= ~_BV(OCIE1A);
+  shutoffAt = micros();
+  shutoffFired = true;
+}
+
+uint16_t calibrationCrc(const Calibration &calibration) {
+  const uint8_t *data = (const uint8_t *)&calibration;
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i = 0; i < offsetof(Calibration, crc); i++) {
+    crc = _crc16_update(crc, data[i]);
+  }
+  return crc;
+}
+
+void loadCalibration() {
+  Calibration calibration;
+  EEPROM.get(CALIBRATION_LOCATION, calibration);
+
+  if (
+    (calibration.version == CALIBRATION_VERSION)
+    && (calibration.crc == calibrationCrc(calibration))
+  ) {
+    scale.set_offset(calibration.offset);
+    scale.set_scale_q20(calibration.mgPerCount);
+  } else {
+    // Zero tracking will find the offset on its own
+    Serial.println("No calibration stored");
+    scale.set_offset(0);
+    scale.set_scale_q20(SCALE_MG_PER_COUNT);
+  }
+}
+
+void saveCalibration() {
+  Calibration calibration;
+  calibration.version = CALIBRATION_VERSION;
+  calibration.offset = scale.get_offset();
+  calibration.mgPerCount = scale.get_scale_q20();
+  calibration.crc = calibrationCrc(calibration);
+  EEPROM.put(CALIBRATION_LOCATION, calibration);
+}
+
+// Averages the next CALIBRATION_SAMPLES samples without blocking;
+// handleScale() collects them, calibrationAverage() hands out the
+// result once.
+void startCalibrationAverage() {
+  calibrationSum = 0;
+  calibrationCount = CALIBRATION_SAMPLES;
+  calibrationPending = true;
+}
+
+bool calibrationAverage(int32_t &average) {
+  if (!calibrationPending || (calibrationCount > 0)) {
+    return false;
+  }
+  calibrationPending = false;
+  average = calibrationSum / CALIBRATION_SAMPLES;
+  return true;
+}
+
+bool isGrinding() {
+  return (
+    (controller.current() == STATE_GRINDING)
+    || (controller.current() == STATE_GRINDING_WEIGHT)
+  );
+}
+
 void setup() {
   wdt_reset();
   wdt_enable(WDTO_4S);
@@ -62,66 +383,115 @@ void setup() {
   digitalWrite(GRINDER_SIG, HIGH);
   pinMode(GRINDER_SIG, OUTPUT);
 
-  lastMessageDisplay.reserve(32);
-  messageDisplay.reserve(32);
-
+  I2C.begin();
   interface.begin();
+  interface.configure(interfaceConfig);
 
-  interface.pinMode(INTERFACE_ROTARY_SIG, INPUT);
-  interface.pullUp(INTERFACE_ROTARY_SIG, HIGH);
-
-  interface.pinMode(INTERFACE_ROTARY_GND, OUTPUT);
-  interface.digitalWrite(INTERFACE_ROTARY_GND, LOW);
-
-  interface.pinMode(INTERFACE_ROTARY_SIG_DIR, INPUT);
-  interface.pullUp(INTERFACE_ROTARY_SIG_DIR, HIGH);
+  pinMode(INTERFACE_INT, INPUT_PULLUP);
+  *digitalPinToPCMSK(INTERFACE_INT) |= _BV(digitalPinToPCMSKbit(INTERFACE_INT));
+  PCICR |= _BV(digitalPinToPCICRbit(INTERFACE_INT));
 
-  interface.pinMode(INTERFACE_BUTTON_GND, OUTPUT);
-  interface.digitalWrite(INTERFACE_BUTTON_GND, LOW);
-
-  interface.pinMode(INTERFACE_BUTTON_SIG, INPUT);
-  interface.pullUp(INTERFACE_BUTTON_SIG, HIGH);
+  // Holding the button while powering up calibrates the scale
+  uint8_t initialState = STATE_SLEEP;
+  if (!bitRead(interface.readGPIOAB(), INTERFACE_BUTTON_SIG)) {
+    initialState = STATE_CALIBRATE_ZERO;
+  }
 
   Serial.begin(9600);
   Serial.print("[Runge ");
   Serial.print(version);
   Serial.println("]");
 
+  scale.begin();
+  loadCalibration();
+  scale.set_zero_tracking(SCALE_ZERO_BAND, SCALE_ZERO_NOISE);
+  scale.set_filter(&scaleFilter);
+  scale.begin_interrupt();
+
   displayCtl.begin();
 
   displayCtl.firstPage();
   do {
-    displayCtl.setFont(u8g2_font_luRS12_tf);
+    displayCtl.setFont(u8g2_font_luRS12_tr);
     displayCtl.drawStr(0, 14, "Runge");
     displayCtl.drawStr(0, 32, version);
   } while(displayCtl.nextPage());
   delay(1000);
   lastMessageDisplay = "Clear me";
+
+  controller.begin(initialState);
 }
 
-void setSavedSeconds(uint8_t value) {
-  uint8_t saved = EEPROM.read(SAVED_SECONDS_LOCATION);
+void setSavedDoseMs(uint16_t value) {
+  uint16_t saved;
+  EEPROM.get(SAVED_DOSE_MS_LOCATION, saved);
   if (saved != value) {
-    EEPROM.write(SAVED_SECONDS_LOCATION, value);
+    EEPROM.put(SAVED_DOSE_MS_LOCATION, value);
   }
 }
 
-uint8_t getSavedSeconds() {
-  uint8_t value = EEPROM.read(SAVED_SECONDS_LOCATION);
+uint16_t getSavedDoseMs() {
+  uint16_t value;
+  EEPROM.get(SAVED_DOSE_MS_LOCATION, value);
 
-  if(value == 255) {
-    setSavedSeconds(DEFAULT_SECONDS);
-    return DEFAULT_SECONDS;
+  if(value == 0xFFFF) {
+    // Carry over a dose saved in whole seconds
+    uint8_t seconds = EEPROM.read(SAVED_SECONDS_LOCATION);
+    value = (seconds == 255) ? DEFAULT_DOSE_MS : seconds * 1000U;
   }
+  value = constrain(
+    value / DOSE_STEP_MS * DOSE_STEP_MS,
+    DOSE_MIN_MS,
+    DOSE_MAX_MS
+  );
+  setSavedDoseMs(value);
 
   return value;
 }
 
-void (*resetNow)(void) = 0;
+uint8_t getSavedMode() {
+  if (EEPROM.read(SAVED_MODE_LOCATION) == STATE_WEIGHT) {
+    return STATE_WEIGHT;
+  }
+  return STATE_TIME;
+}
 
-void handleInterface() {
-  uint16_t interfaceStatus = interface.readGPIOAB();
+void setSavedMode(uint8_t value) {
+  if (EEPROM.read(SAVED_MODE_LOCATION) != value) {
+    EEPROM.write(SAVED_MODE_LOCATION, value);
+  }
+}
+
+void setSavedDecigrams(uint16_t value) {
+  uint16_t saved;
+  EEPROM.get(SAVED_DECIGRAMS_LOCATION, saved);
+  if (saved != value) {
+    EEPROM.put(SAVED_DECIGRAMS_LOCATION, value);
+  }
+}
 
+uint16_t getSavedDecigrams() {
+  uint16_t value;
+  EEPROM.get(SAVED_DECIGRAMS_LOCATION, value);
+
+  if(value == 0xFFFF) {
+    setSavedDecigrams(DEFAULT_DECIGRAMS);
+    return DEFAULT_DECIGRAMS;
+  }
+
+  return value;
+}
+
+void appendDecigrams(long decigrams) {
+  if (decigrams < 0) {
+    decigrams = 0;
+  }
+  messageDisplay.appendTenths(decigrams);
+}
+
+void (*resetNow)(void) = 0;
+
+void processInterface(uint16_t interfaceStatus) {
   uint8_t buttonState = bitRead(interfaceStatus, INTERFACE_BUTTON_SIG);
   uint8_t sig = bitRead(interfaceStatus, INTERFACE_ROTARY_SIG);
   uint8_t sig_dir = bitRead(interfaceStatus, INTERFACE_ROTARY_SIG_DIR);
@@ -136,145 +506,822 @@ void handleInterface() {
   }
   if (button.fell()) {
     buttonFell = true;
+    pressHandled = false;
+  } else if (button.rose() && !pressHandled) {
+    buttonPressed = true;
+    pressHandled = true;
+  }
+}
+
+void handleInterface() {
+  // INT stays asserted until the expander is read, so checking the
+  // line as well catches an edge that came in while we were reading.
+  bool pending = (digitalRead(INTERFACE_INT) == LOW);
+
+  if (pending || interfaceChanged) {
+    // Picked up on a later pass, once the bus gets to it
+    if (interface.requestInterrupt()) {
+      interfaceChanged = false;
+    }
+  }
+  MCP23017_Interrupt change;
+  if (interface.collectInterrupt(change)) {
+    if (change.flags) {
+      // The pins as they were when the change was flagged, so encoder
+      // pulses shorter than a loop pass aren't lost.
+      processInterface(change.captured);
+    }
+    interfaceStatus = change.current;
+  }
+  // Keeps the debouncer running between changes
+  processInterface(interfaceStatus);
+
+  if (
+    !button.read()
+    && !pressHandled
+    && (button.duration() >= LONG_PRESS_INTERVAL)
+  ) {
+    buttonLongPress = true;
+    pressHandled = true;
+  }
+}
+
+void addFlowSample(unsigned long time, long mg) {
+  flowSamples[flowIndex].time = time;
+  flowSamples[flowIndex].mg = mg;
+  flowIndex = (flowIndex + 1) % FLOW_SAMPLES;
+  if (flowCount < FLOW_SAMPLES) {
+    flowCount++;
+  }
+}
+
+// Least-squares line through the recent samples; gives the weight it
+// predicts at `when` and the flow rate in mg/s.
+bool estimateFlow(unsigned long when, long &weight, long &flow) {
+  if (flowCount < 3) {
+    return false;
+  }
+
+  unsigned long t0 = flowSamples[0].time;
+  long y0 = flowSamples[0].mg;
+  long sumT = 0;
+  long sumY = 0;
+  for (uint8_t i = 0; i < flowCount; i++) {
+    sumT += (long)(flowSamples[i].time - t0);
+    sumY += flowSamples[i].mg - y0;
+  }
+  long meanT = sumT / flowCount;
+  long meanY = sumY / flowCount;
+
+  long sxx = 0;
+  long sxy = 0;
+  for (uint8_t i = 0; i < flowCount; i++) {
+    long dt = (long)(flowSamples[i].time - t0) - meanT;
+    sxx += dt * dt;
+    sxy += dt * (flowSamples[i].mg - y0 - meanY);
+  }
+  if (sxx == 0) {
+    return false;
+  }
+
+  flow = ((int64_t)sxy * 1000) / sxx;
+  weight = y0 + meanY + ((int64_t)flow * ((long)(when - t0) - meanT)) / 1000;
+  return true;
+}
+
+void handleScale() {
+  HX711_sample sample;
+
+  // Conversions are clocked out by the DOUT interrupt; we only
+  // collect whatever has arrived since the last pass.
+  scaleStatus = scale.poll();
+  while (scale.read_sample(sample)) {
+    if (
+      (scaleFreshSamples < SCALE_FILTER_SAMPLES)
+      && (sample.gain == scale.get_gain())
+    ) {
+      scaleFreshSamples++;
+    }
+    if ((calibrationCount > 0) && (sample.gain == scale.get_gain())) {
+      calibrationSum += sample.value;
+      calibrationCount--;
+    }
+    if (isGrinding() && (sample.gain == scale.get_gain())) {
+      addFlowSample(
+        sample.time,
+        scale.to_mg(sample.value - scale.get_offset())
+      );
+    }
   }
 }
 
+void startGraph(long fullScaleMg) {
+  memset(graphColumns, 0, sizeof(graphColumns));
+  graphCursor = 0;
+  graphSampledAt = millis();
+  graphFullScaleMg = fullScaleMg;
+  graphChanged = true;
+}
+
+void sampleGraph(unsigned long now, long dosedMg) {
+  if ((now - graphSampledAt) < GRAPH_INTERVAL) {
+    return;
+  }
+  graphSampledAt = now;
+
+  graphColumns[graphCursor] = constrain(
+    dosedMg * GRAPH_HEIGHT / graphFullScaleMg,
+    0,
+    GRAPH_HEIGHT - 1
+  );
+  graphCursor = (graphCursor + 1) % GRAPH_WIDTH;
+  graphChanged = true;
+}
+
+// Grinding screens show the dose and flow rate on two lines
+void appendFlow(unsigned long now) {
+  long weight;
+  long flow = 0;
+  estimateFlow(now, weight, flow);
+
+  messageDisplay.append('\n');
+  // Flow is in mg/s; show g/s to a tenth
+  appendDecigrams((flow + 50) / 100);
+  messageDisplay.append("g/s");
+}
+
+void drawGraph(U8G2& display) {
+  for (uint8_t i = 0; i < GRAPH_WIDTH; i++) {
+    // Leave a gap ahead of the sweep so the newest column stands out
+    if (i != graphCursor) {
+      display.drawPixel(GRAPH_X + i, GRAPH_HEIGHT - 1 - graphColumns[i]);
+    }
+  }
+}
+
+void drawMessage(U8G2& display) {
+  if (!frameShowsGraph) {
+    // The reduced (_tr) charset is all any message uses
+    display.setFont(u8g2_font_luRS24_tr);
+    display.drawStr(0, 28, lastMessageDisplay.c_str());
+    return;
+  }
+
+  char line[MESSAGE_LENGTH + 1];
+  const char* text = lastMessageDisplay.c_str();
+  const char* second = strchr(text, '\n');
+  uint8_t length = second ? (second - text) : strlen(text);
+  memcpy(line, text, length);
+  line[length] = '\0';
+
+  display.setFont(u8g2_font_luRS12_tr);
+  display.drawStr(0, 14, line);
+  if (second) {
+    display.drawStr(0, 31, second + 1);
+  }
+  drawGraph(display);
+}
+
 void setGrinderState(bool enabled) {
   digitalWrite(GRINDER_SIG, !enabled);
 }
 
+// Turns the grinder on and arms Timer1 to turn it off again after
+// duration ms, however long loop() passes happen to take by then.
+void startTimedGrind(unsigned long duration) {
+  uint32_t ticks = duration * SHUTOFF_TICKS_PER_MS;
+
+  noInterrupts();
+  TCCR1B = 0;
+  TCCR1A = 0;
+  TCNT1 = 0;
+  // A match at 0 would only come after a full lap
+  OCR1A = max((uint16_t)ticks, (uint16_t)1);
+  shutoffLaps = ticks >> 16;
+  shutoffFired = false;
+  TIFR1 = _BV(OCF1A);
+  TIMSK1 |= _BV(OCIE1A);
+
+  setGrinderState(true);
+  shutoffDeadline = micros() + duration * 1000;
+  TCCR1B = _BV(CS11) | _BV(CS10);
+  interrupts();
+}
+
+bool timedGrindArmed() {
+  return TIMSK1 & _BV(OCIE1A);
+}
+
+// Disarms the ISR before turning the grinder off, so the two never race
+void cancelTimedGrind() {
+  noInterrupts();
+  TIMSK1 &= ~_BV(OCIE1A);
+  TCCR1B = 0;
+  interrupts();
+  setGrinderState(false);
+}
+
+// Prints how far off this cut-off was, and how far off it would have
+// been had loop() done it when it noticed.
+void reportShutoff(unsigned long observedAt) {
+  long error = (long)(shutoffAt - shutoffDeadline);
+  long loopError = (long)(observedAt - shutoffDeadline);
+
+  if ((shutoffCount == 0) || (error < shutoffErrorMin)) {
+    shutoffErrorMin = error;
+  }
+  if ((shutoffCount == 0) || (error > shutoffErrorMax)) {
+    shutoffErrorMax = error;
+  }
+  shutoffCount++;
+
+  Serial.print("Cut-off error (us): ");
+  Serial.print(error);
+  Serial.print(", by loop: ");
+  Serial.print(loopError);
+  Serial.print(", jitter over ");
+  Serial.print(shutoffCount);
+  Serial.print(" doses: ");
+  Serial.println(shutoffErrorMax - shutoffErrorMin);
+}
+
+void exitLowPower() {
+  lowPower = false;
+  // What the filter holds is from before we slept, and the first
+  // conversions are still settling (power_up() drops those)
+  scale.power_up();
+  scaleFilter.reset();
+  scaleFreshSamples = 0;
+  displayCtl.setPowerSave(0);
+  // Whatever the controller kept through power save isn't to be trusted
+  renderer.invalidate();
+}
+
+// Powers down until the knob or button changes (the expander's INT), or
+// the watchdog fires ahead of the next deadline. The 500ms interface
+// health check isn't a deadline: it runs whenever we're awake anyway.
+// Returns whether we slept.
+bool sleepUntil(unsigned long now, unsigned long deadline) {
+  if ((long)(deadline - now) <= 0) {
+    return false;
+  }
+  unsigned long remaining = deadline - now;
+
+  // Longest watchdog period (16ms << prescale) that doesn't overshoot
+  uint8_t prescale = SLEEP_LONGEST_PRESCALE;
+  while ((prescale > 0) && ((16UL << prescale) > remaining)) {
+    prescale--;
+  }
+  if ((16UL << prescale) > remaining) {
+    return false;
+  }
+
+  if (!lowPower) {
+    lowPower = true;
+    scale.power_down();
+    displayCtl.setPowerSave(1);
+  }
+  // The TWI and UART stop with the clock. A bus that won't empty gets
+  // another go on the next pass.
+  unsigned long drainStartedAt = micros();
+  while (!I2C.idle()) {
+    if ((micros() - drainStartedAt) > SLEEP_DRAIN_TIMEOUT) {
+      return false;
+    }
+    I2C.service();
+  }
+  Serial.flush();
+
+  // Interrupt only, no reset. Worked out ahead of time: the second
+  // store has to land within 4 cycles of the unlock.
+  uint8_t wdtcsr = (
+    _BV(WDIE)
+    | (prescale & 0x07)
+    | ((prescale & 0x08) ? _BV(WDP3) : 0)
+  );
+
+  noInterrupts();
+  watchdogWoke = false;
+  wdt_reset();
+  // Back to back, as in avr-libc's wdt_enable()
+  __asm__ __volatile__ (
+    "sts %0, %1" "\n\t"
+    "sts %0, %2" "\n\t"
+    :
+    : "n" (_SFR_MEM_ADDR(WDTCSR)),
+      "r" ((uint8_t)(_BV(WDCE) | _BV(WDE))),
+      "r" (wdtcsr)
+    : "memory"
+  );
+  set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+  sleep_enable();
+  // A change that came in since we last looked wakes nothing, so check
+  // here; sleep_cpu() runs before any interrupt the sei lets through.
+  if (!interfaceChanged && (digitalRead(INTERFACE_INT) == HIGH)) {
+    interrupts();
+    sleep_cpu();
+  } else {
+    interrupts();
+  }
+  sleep_disable();
+  wdt_enable(WDTO_4S);
+
+  // Only the watchdog says how long we slept; an early wake from the
+  // knob leaves millis() behind by less than a period, and takes us out
+  // of sleep anyway.
+  if (watchdogWoke) {
+    noInterrupts();
+    timer0_millis += (16UL << prescale);
+    interrupts();
+  }
+  return true;
+}
+
+
 void updateSleepTimeout(uint8_t seconds = 15) {
   sleepTimeout = millis() + (seconds * 1000);
 }
 
-void setState(uint8_t _state) {
+void reportState(uint8_t from, uint8_t to) {
   Serial.print("State Change: ");
-  Serial.println(_state);
-  state = _state;
+  Serial.println(to);
+}
+
+bool anyInput() {
+  return buttonPressed || buttonLongPress || rotateLeft || rotateRight;
+}
+
+// Stopping a grind can't wait for the button to come back up; doing it
+// on the way down keeps the release from counting as a press too.
+bool buttonDown() {
+  if (buttonFell) {
+    pressHandled = true;
+  }
+  return buttonFell;
+}
+
+// Back to whichever of time and weight selection was used last
+uint8_t resumeEvent() {
+  if (getSavedMode() == STATE_WEIGHT) {
+    return EVENT_WEIGHT_MODE;
+  }
+  return EVENT_TIME_MODE;
+}
+
+void lockout(const char* message) {
+  messageDisplay = message;
+  displayForced = true;
+  controller.dispatch(EVENT_FAULT);
+}
+
+void startDose() {
+  grindStartMg = scale.get_filtered_mg();
+  doseMg = -1;
+  flowCount = 0;
+  flowIndex = 0;
+}
+
+void tickSleep(unsigned long now) {
+  if (anyInput()) {
+    controller.dispatch(resumeEvent());
+  } else if (now > resetAfterTimeout) {
+    // If we've been up for a while, and nothing's going on --
+    // let's reset to make sure our values are reset.
+    resetNow();
+  }
+}
+
+void exitSleep(unsigned long) {
+  if (lowPower) {
+    exitLowPower();
+  }
+}
+
+void enterTime(unsigned long) {
+  if (doseMsSelected == 0) {
+    doseMsSelected = getSavedDoseMs();
+  }
+  setSavedMode(STATE_TIME);
+  updateSleepTimeout();
 }
 
+void tickTime(unsigned long) {
+  if (rotateRight && (doseMsSelected < DOSE_MAX_MS)) {
+    doseMsSelected += DOSE_STEP_MS;
+  } else if (rotateLeft && (doseMsSelected > DOSE_MIN_MS)) {
+    doseMsSelected -= DOSE_STEP_MS;
+  }
+
+  messageDisplay.appendTenths(doseMsSelected / 100);
+  messageDisplay.append('s');
+
+  if (buttonLongPress) {
+    controller.dispatch(EVENT_LONG_PRESS);
+  } else if (buttonPressed) {
+    controller.dispatch(EVENT_PRESS);
+  }
+}
+
+void enterWeight(unsigned long) {
+  if (decigramsSelected == 0) {
+    decigramsSelected = getSavedDecigrams();
+  }
+  setSavedMode(STATE_WEIGHT);
+  updateSleepTimeout();
+  weightStartPending = false;
+}
+
+void tickWeight(unsigned long) {
+  if (rotateRight) {
+    decigramsSelected++;
+  } else if (rotateLeft) {
+    decigramsSelected--;
+  }
+
+  if (decigramsSelected < 10) {
+    decigramsSelected = 10;
+  } else if (decigramsSelected > 500) {
+    decigramsSelected = 500;
+  }
+
+  if (weightStartPending) {
+    messageDisplay = "Wait";
+  } else {
+    appendDecigrams(decigramsSelected);
+    messageDisplay.append('g');
+  }
+
+  if (buttonLongPress) {
+    weightStartPending = false;
+    controller.dispatch(EVENT_LONG_PRESS);
+  } else if (buttonPressed) {
+    weightStartPending = true;
+  }
+
+  // The dose is measured from the weight at the start, so that has to
+  // come from the scale as it is now
+  if (weightStartPending) {
+    if (scaleStatus == HX711_TIMEOUT) {
+      Serial.print("No reading from scale!");
+      weightStartPending = false;
+      lockout("ERR: Scl");
+    } else if (scaleFreshSamples >= SCALE_FILTER_SAMPLES) {
+      weightStartPending = false;
+      controller.dispatch(EVENT_PRESS);
+    }
+  }
+}
+
+void enterGrinding(unsigned long) {
+  startDose();
+  startGraph(GRAPH_DEFAULT_MG);
+  setSavedDoseMs(doseMsSelected);
+  startTimedGrind(doseMsSelected);
+}
+
+void tickGrinding(unsigned long now) {
+  unsigned long elapsed = controller.elapsed();
+  unsigned long millisRemaining = 0;
+  if (elapsed < doseMsSelected) {
+    millisRemaining = doseMsSelected - elapsed;
+  }
+
+  // Counts down in tenths, rounded up so 0.0 only shows once it's cut
+  messageDisplay
+    .appendTenths((millisRemaining + 99) / 100)
+    .append('/')
+    .appendTenths(doseMsSelected / 100)
+    .append('s');
+  appendFlow(now);
+  sampleGraph(now, scale.get_filtered_mg() - grindStartMg);
+
+  if (shutoffFired) {
+    reportShutoff(micros());
+    controller.dispatch(EVENT_FINISHED);
+  } else if (buttonDown()) {
+    controller.dispatch(EVENT_PRESS);
+  }
+}
+
+void exitGrinding(unsigned long) {
+  cancelTimedGrind();
+}
+
+void enterGrindingWeight(unsigned long) {
+  startDose();
+  doseTargetMg = decigramsSelected * 100L;
+  startGraph(doseTargetMg);
+  setSavedDecigrams(decigramsSelected);
+}
+
+void tickGrindingWeight(unsigned long now) {
+  long dosed = scale.get_filtered_mg() - grindStartMg;
+
+  // Cut early enough that what is still in flight, plus what the
+  // scale hasn't caught up with yet, lands us on the target.
+  long predicted = dosed;
+  long flow = 0;
+  if (estimateFlow(now + GRINDER_COAST + SCALE_LATENCY, predicted, flow)) {
+    predicted -= grindStartMg;
+  }
+  predicted += overshootMg;
+
+  appendDecigrams((dosed + 50) / 100);
+  messageDisplay.append('/');
+  appendDecigrams(decigramsSelected);
+  messageDisplay.append('g');
+  appendFlow(now);
+  sampleGraph(now, dosed);
+
+  if (buttonDown()) {
+    controller.dispatch(EVENT_PRESS);
+  } else if ((predicted >= doseTargetMg) || (dosed >= doseTargetMg)) {
+    doseSettling = true;
+    controller.dispatch(EVENT_FINISHED);
+  }
+}
+
+void enterDone(unsigned long) {
+  updateSleepTimeout();
+}
+
+void tickDone(unsigned long) {
+  // Once the grounds have settled, learn how far off the prediction
+  // was so the next dose is cut a little earlier or later.
+  if (doseSettling && (controller.elapsed() > DOSE_SETTLE_INTERVAL)) {
+    doseSettling = false;
+    doseMg = scale.get_filtered_mg() - grindStartMg;
+    overshootMg = constrain(
+      overshootMg + (doseMg - doseTargetMg) / 2,
+      -OVERSHOOT_LIMIT,
+      OVERSHOOT_LIMIT
+    );
+    Serial.print("Dosed (mg): ");
+    Serial.println(doseMg);
+  }
+  // The dose, once it's known, in place of Ready
+  if (!doseSettling && (doseMg >= 0)) {
+    appendDecigrams((doseMg + 50) / 100);
+    messageDisplay.append('g');
+  } else {
+    messageDisplay = "Ready";
+  }
+
+  if (anyInput()) {
+    controller.dispatch(resumeEvent());
+  }
+}
+
+void exitDone(unsigned long) {
+  doseSettling = false;
+}
+
+void tickLockout(unsigned long) {
+  // To make sure the loop in this case isn't essentially instant,
+  // let's delay a bit.  This'll also allow the screen a chance to
+  // settle before we begin re-rendering it.
+  delay(500);
+}
+
+void tickCalibrateZero(unsigned long) {
+  // Empty the platform, press, and wait for the zero to be taken
+  int32_t average;
+  if (buttonPressed && !calibrationPending) {
+    startCalibrationAverage();
+  }
+  messageDisplay = calibrationPending ? "Wait" : "Empty?";
+
+  if (calibrationAverage(average)) {
+    scale.set_offset(average);
+    controller.dispatch(EVENT_FINISHED);
+  }
+}
+
+void tickCalibrateMass(unsigned long) {
+  // Dial in the reference mass, put it on, press
+  int32_t average;
+  if (!calibrationPending) {
+    if (rotateRight && (calibrationGrams < 1000)) {
+      calibrationGrams++;
+    } else if (rotateLeft && (calibrationGrams > 1)) {
+      calibrationGrams--;
+    }
+    if (buttonPressed) {
+      startCalibrationAverage();
+    }
+  }
+  if (calibrationPending) {
+    messageDisplay = "Wait";
+  } else {
+    messageDisplay.append(calibrationGrams).append("g?");
+  }
+
+  if (calibrationAverage(average)) {
+    int32_t counts = average - scale.get_offset();
+    if (counts == 0) {
+      Serial.println("Reference mass not seen");
+    } else {
+      scale.set_scale_q20(
+        (((int64_t)calibrationGrams * 1000) << 20) / counts
+      );
+      controller.dispatch(EVENT_FINISHED);
+    }
+  }
+}
+
+void tickCalibrateConfirm(unsigned long) {
+  // Shows the live weight; press keeps it, a long press throws it away.
+  // Nothing is written until the button is let go, so the press can
+  // still turn out to be a long one.
+  appendDecigrams((scale.get_filtered_mg() + 50) / 100);
+  messageDisplay.append('g');
+  if (buttonLongPress) {
+    loadCalibration();
+    Serial.println("Calibration discarded");
+    controller.dispatch(resumeEvent());
+  } else if (buttonPressed) {
+    saveCalibration();
+    Serial.println("Calibration saved");
+    controller.dispatch(resumeEvent());
+  }
+}
+
+// Indexed by STATE_*
+const StateDef controllerStates[STATE_COUNT] PROGMEM = {
+  // enter, tick, exit
+  { NULL, tickSleep, exitSleep },
+  { enterTime, tickTime, NULL },
+  { enterGrinding, tickGrinding, exitGrinding },
+  { enterDone, tickDone, exitDone },
+  { NULL, tickLockout, NULL },
+  { enterWeight, tickWeight, NULL },
+  { enterGrindingWeight, tickGrindingWeight, NULL },
+  { NULL, tickCalibrateZero, NULL },
+  { NULL, tickCalibrateMass, NULL },
+  { NULL, tickCalibrateConfirm, NULL },
+};
+
+// Where each EVENT_* leads from each state. Grinding and calibration
+// never go idle, and nothing but a reset leaves the lockout.
+#define STAY STATE_MACHINE_IGNORE
+const uint8_t controllerTransitions[STATE_COUNT][EVENT_COUNT] PROGMEM = {
+  // Press, long press, idle, fault, finished, time mode, weight mode
+  // STATE_SLEEP
+  { STAY, STAY, STAY, STATE_LOCKOUT, STAY, STATE_TIME, STATE_WEIGHT },
+  // STATE_TIME
+  {
+    STATE_GRINDING, STATE_WEIGHT, STATE_SLEEP, STATE_LOCKOUT,
+    STAY, STAY, STAY
+  },
+  // STATE_GRINDING
+  { STATE_DONE, STAY, STAY, STATE_LOCKOUT, STATE_DONE, STAY, STAY },
+  // STATE_DONE
+  { STAY, STAY, STATE_SLEEP, STATE_LOCKOUT, STAY, STATE_TIME, STATE_WEIGHT },
+  // STATE_LOCKOUT
+  { STAY, STAY, STAY, STAY, STAY, STAY, STAY },
+  // STATE_WEIGHT
+  {
+    STATE_GRINDING_WEIGHT, STATE_TIME, STATE_SLEEP, STATE_LOCKOUT,
+    STAY, STAY, STAY
+  },
+  // STATE_GRINDING_WEIGHT
+  { STATE_DONE, STAY, STAY, STATE_LOCKOUT, STATE_DONE, STAY, STAY },
+  // STATE_CALIBRATE_ZERO
+  { STAY, STAY, STAY, STATE_LOCKOUT, STATE_CALIBRATE_MASS, STAY, STAY },
+  // STATE_CALIBRATE_MASS
+  { STAY, STAY, STAY, STATE_LOCKOUT, STATE_CALIBRATE_CONFIRM, STAY, STAY },
+  // STATE_CALIBRATE_CONFIRM
+  { STAY, STAY, STAY, STATE_LOCKOUT, STAY, STATE_TIME, STATE_WEIGHT },
+};
+#undef STAY
+
 void loop() {
   wdt_reset();
+#ifdef LOOP_PROFILE
+  handleProfile();
+#endif
   unsigned long now = millis();
 
-  messageDisplay = "";
+  messageDisplay.clear();
 
   rotateLeft = false;
   rotateRight = false;
   buttonFell = false;
+  buttonPressed = false;
+  buttonLongPress = false;
 
-  bool forceDisplay = false;
-
+  I2C.service();
   handleInterface();
+  handleScale();
 
   // Sleep cycle handler
-  if(buttonFell || rotateLeft || rotateRight) {
+  if (anyInput()) {
     updateSleepTimeout();
-  } else if (
-    (now > sleepTimeout)
-    && (state != STATE_SLEEP)
-    && (state != STATE_LOCKOUT)
-  ) {
-    setState(STATE_SLEEP);
+  } else if (now > sleepTimeout) {
+    controller.dispatch(EVENT_IDLE);
   }
 
   // Sanity checks
-  if (!interface.ping()) {
-    Serial.print("Could not connect to controller!");
-    messageDisplay = "ERR: IfcP";
-    setState(STATE_LOCKOUT);
-    forceDisplay = true;
+  if ((now - interfaceCheckedAt) > INTERFACE_HEALTH_INTERVAL) {
+    interfaceCheckedAt = now;
+    // Nothing reads the expander while the knob is left alone, so read it
+    // anyway now and then; its status is our health check.
+    interfaceChanged = true;
+  }
+  if (interface.status() != I2C_OK) {
+    Serial.print("Could not connect to controller! I2C status ");
+    Serial.print(interface.status());
+    Serial.print(", NACKs ");
+    Serial.print(I2C.nacks());
+    Serial.print(", timeouts ");
+    Serial.print(I2C.timeouts());
+    Serial.print(", recoveries ");
+    Serial.println(I2C.recoveries());
+    lockout("ERR: IfcP");
   } else if (
-    (state == STATE_GRINDING)
-    && ((now - grinderStart) > GRINDER_SAFETY_LOCKOUT)
+    isGrinding()
+    && (controller.elapsed() > GRINDER_SAFETY_LOCKOUT)
   ) {
     Serial.print("Grinder safety lockout!");
-    messageDisplay = "ERR: GndT";
-    forceDisplay = true;
-    setState(STATE_LOCKOUT);
+    lockout("ERR: GndT");
+  } else if (
+    (controller.current() == STATE_GRINDING_WEIGHT)
+    && (scaleStatus == HX711_TIMEOUT)
+  ) {
+    Serial.print("Scale stopped responding!");
+    lockout("ERR: Scl");
   }
 
-  // State handler
-  if (state == STATE_SLEEP) {
-    if (buttonFell || rotateLeft || rotateRight) {
-      setState(STATE_TIME);
-    } else {
-      // If we've been up for a while, and nothing's going on --
-      // let's reset to make sure our values are reset.
-      if (now > resetAfterTimeout) {
-        resetNow();
-      }
-    }
-  } else if (state == STATE_TIME) {
-    if (secondsSelected == 0) {
-      secondsSelected = getSavedSeconds();
-    }
-    if (rotateRight) {
-      secondsSelected++;
-    } else if (rotateLeft) {
-      secondsSelected--;
-    }
+  controller.tick();
 
-    if (secondsSelected < 1) {
-      secondsSelected = 1;
-    } else if (secondsSelected > 20) {
-      secondsSelected = 20;
-    }
-
-    if (buttonFell) {
-      grinderStart = millis();
-      setSavedSeconds(secondsSelected);
-      setState(STATE_GRINDING);
-    }
-
-    messageDisplay = String(secondsSelected) + "s";
-  } else if (state == STATE_GRINDING) {
-    updateSleepTimeout();
-    if(buttonFell) {
-      setState(STATE_DONE);
-    }
-    if(grinderTimeout == 0) {
-      grinderTimeout = now + (secondsSelected * 1000);
-    }
-
-    unsigned long millisRemaining = 0;
-    if (now < grinderTimeout) {
-      millisRemaining = grinderTimeout - now;
-    }
-
-    messageDisplay = String(round(millisRemaining / 1000) + 1) + "/" + String(secondsSelected) + "s";
+  uint8_t state = controller.current();
+  // While Timer1 is armed the pin is its ISR's alone: a write from here
+  // could turn the grinder back on just after it was cut. Once it has
+  // cut a timed dose, it stays cut.
+  if (!timedGrindArmed()) {
+    setGrinderState(
+      isGrinding() && !((state == STATE_GRINDING) && shutoffFired)
+    );
+  }
+  // Not while asleep: the scale is powered down then, so there'd be
+  // nothing to track
+  scale.enable_zero_tracking(state == STATE_DONE);
 
-    if (now > grinderTimeout) {
-      setState(STATE_DONE);
-    }
-  } else if (state == STATE_DONE) {
-    messageDisplay = "Ready";
-    grinderTimeout = 0;
+  // A lost write leaves a tile the renderer thinks is up to date
+  if (
+    (I2C.dropped() != displayDropped)
+    || (I2C.recoveries() != displayRecoveries)
+    || (
+      (state != STATE_SLEEP)
+      && ((now - displayRefreshedAt) >= DISPLAY_REFRESH_INTERVAL)
+    )
+  ) {
+    displayForced = true;
+  }
 
-    if(buttonFell || rotateLeft || rotateRight) {
-      setState(STATE_TIME);
+  // Frames start at most every MESSAGE_INTERVAL, showing whatever the
+  // message is by then, and go out one tile row per pass.
+  if (
+    !renderer.rendering()
+    && (
+      displayForced
+      || graphChanged
+      || (lastMessageDisplay != messageDisplay)
+    )
+    && (displayForced || ((now - frameStartedAt) >= MESSAGE_INTERVAL))
+  ) {
+    if (displayForced) {
+      renderer.invalidate();
+      displayForced = false;
+      displayRefreshedAt = now;
+      displayDropped = I2C.dropped();
+      displayRecoveries = I2C.recoveries();
     }
-  } else if (state == STATE_LOCKOUT) {
-    // To make sure the loop in this case isn't essentially instant,
-    // let's delay a bit.  This'll also allow the screen a chance to
-    // settle before we begin re-rendering it.
-    delay(500);
-  } else {
-    // Unexpected state
-    Serial.print("Unexpected state: ");
-    Serial.println(state);
-    setState(STATE_TIME);
+    lastMessageDisplay = messageDisplay;
+    frameShowsGraph = isGrinding();
+    graphChanged = false;
+    frameStartedAt = now;
+    renderer.startFrame();
   }
-
-  setGrinderState(state == STATE_GRINDING);
-
-  if(forceDisplay || (lastMessageDisplay != messageDisplay)) {
-    displayCtl.firstPage();
+  if (renderer.rendering()) {
+    // Lockout passes are slow on purpose; get the error up in one go
     do {
-      displayCtl.setFont(u8g2_font_luRS24_tf);
-      displayCtl.drawStr(0, 28, messageDisplay.c_str());
-    } while(displayCtl.nextPage());
-    
-    lastMessageDisplay = messageDisplay;
+      renderer.step(drawMessage);
+    } while (state == STATE_LOCKOUT && renderer.rendering());
+  }
+
+  // Once the blank frame is out, nothing happens until the knob moves or
+  // it's time to reset
+  if (
+    (state == STATE_SLEEP)
+    && !renderer.rendering()
+    && (lastMessageDisplay == messageDisplay)
+  ) {
+    if (sleepUntil(now, resetAfterTimeout)) {
+#ifdef LOOP_PROFILE
+      // Draining and sleeping isn't loop latency
+      loopProfile.skip();
+#endif
+    }
   }
 }